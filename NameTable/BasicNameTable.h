@@ -0,0 +1,1000 @@
+#ifndef BASICNAMETABLE_INCLUDED
+#define BASICNAMETABLE_INCLUDED
+
+#include "NameTable.h"
+#include "HashPolicies.h"
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+  // The symbol index hashes names with this policy from HashPolicies.h.
+  // It is picked at compile time, not passed in, so the hash inlines right
+  // into the probe loops; build with -DNAMETABLE_HASH=Fnv1aHash (for
+  // example) to try another.  CRC32C is the quickest on identifiers when
+  // the CPU has an instruction for it, and WyHash otherwise.
+#ifndef NAMETABLE_HASH
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#define NAMETABLE_HASH Crc32cHash
+#else
+#define NAMETABLE_HASH WyHash
+#endif
+#endif
+
+  // A BasicNameTable<V> is a NameTable whose declarations carry a V (type
+  // information, say) instead of a line number.  The V is stored right in
+  // the declaration, so looking a name up finds its attributes too, and
+  // find returns a pointer to it, or nullptr if the name isn't visible.
+  // A pointer from find is only good until the next call of a non-const
+  // member function (intern, declare, enterScope, exitScope, begin, commit
+  // or rollback): interning can move every declaration, and a declaration
+  // that shadows x moves the outer x's value aside and puts its own where
+  // it was, so a pointer taken to the outer x would then see the inner x.
+  // Find the name again instead of holding on to the pointer.  Writes
+  // through the pointer aren't logged, so rollback doesn't undo them.
+  // V must be default constructible and movable.  NameTable itself is a
+  // BasicNameTable<int> behind a pointer, with the line number as the V.
+
+template<typename V, typename Hash = NAMETABLE_HASH>
+class BasicNameTable;
+template<typename V, typename Hash = NAMETABLE_HASH>
+class BasicFrozenNameTable;
+
+namespace nametabledetail
+{
+
+//*********** HashtableByDepth implementation and functions **************
+//*********** HashtableByDepth implementation and functions **************
+//*********** HashtableByDepth implementation and functions **************
+//*********** HashtableByDepth implementation and functions **************
+//*********** HashtableByDepth implementation and functions **************
+
+template<typename V, typename Hash>
+class HashTable
+{
+    private:
+        //Every declaration is linked into two lists without any extra nodes: its symbol's shadow chain and the
+        //list of everything declared in the same scope. Exiting a scope walks its list and unlinks each
+        //declaration from the front of its shadow chain, with no hashing or searching.
+        //With LAZY_EXIT, exiting a scope only forgets the scope's epoch. Declarations remember the epoch of the
+        //scope they were made in, so stale ones are skipped by find and cleaned up by the next declaration of the
+        //same name or by a sweep once enough garbage has built up in the arena.
+        struct declaration{//an outer declaration that is currently shadowed by an inner one
+            V m_Value;
+            int m_Depth;
+            int m_Shadowed;//index in the arena of the next declaration out, or -1
+            SymbolId m_NextInScope;
+            std::uint64_t m_Epoch;
+        };
+        struct symbol{//every distinct name is interned once; its innermost live declaration is kept right in here
+            size_t m_Hash;
+            unsigned m_NameStart;//where the spelling starts in names
+            unsigned m_NameLength;
+            V m_Value;
+            int m_Depth;//-1 if nothing is declared with this name right now
+            int m_Shadowed;
+            SymbolId m_NextInScope;//the symbol declared just before this one in the same scope, or -1
+            std::uint64_t m_Epoch;
+        };
+        static constexpr unsigned char EMPTY = 0;
+        static constexpr unsigned char FULL = 0x80;
+        static constexpr size_t INITIAL_SLOTS = 16;//always a power of two
+        static constexpr size_t MIN_SWEEP = 1024;
+        //open addressing with linear probing: control[i] is EMPTY or FULL plus 7 bits of the slot's hash,
+        //so almost every mismatch is rejected without touching the symbol or its spelling.
+        //Nothing is allocated until the first name is interned.
+        std::vector<unsigned char> control;
+        std::vector<SymbolId> slots;
+        std::vector<symbol> symbols;//indexed by SymbolId
+        std::vector<char> names;//every interned spelling, back to back
+        //A declaration is only moved into the arena when a declaration in the innermost scope shadows it, and it
+        //comes back out when that scope exits, so the arena is a stack: declaring bumps its end and exiting a
+        //scope releases everything the scope pushed by cutting the end back to where the scope started.
+        std::vector<declaration> arena;
+        struct scope{//two ints and an epoch per open scope, no matter how deep the nesting goes
+            SymbolId m_Head;//the symbol declared most recently in this scope, or -1
+            int m_ArenaStart;
+            std::uint64_t m_Epoch;//different for every scope ever entered; the outermost scope's is 0
+        };
+        //A counting Bloom filter over the symbols that have a declaration, so find can turn away most names that
+        //aren't declared anywhere after reading one cache line, without probing the index or touching a symbol.
+        //Each block is a cache line of 128 4-bit counters, and all of a name's counters are in one block. A
+        //counter that reaches 15 sticks there until the filter is next rebuilt, which happens whenever the index
+        //grows or the arena is swept. With LAZY_EXIT, names stay in the filter until their stale declarations are
+        //actually dropped, which only costs some extra probes.
+        struct alignas(64) filterBlock{
+            unsigned char m_Counters[64];//two counters per byte
+        };
+        static constexpr int FILTER_PROBES = 4;
+        static constexpr size_t SLOTS_PER_FILTER_BLOCK = 16;//about 8 counters per symbol
+        std::vector<filterBlock> filter;
+        SymbolId outermostHead;
+        std::vector<scope> scopes;//scopes[n] is for scope n+1
+        bool lazyExit;
+        std::uint64_t nextEpoch;//64 bits, so it never wraps around and no epoch is ever handed out twice
+        size_t sweepAt;//with LAZY_EXIT, sweep when the arena gets this big
+        //running totals for stats(), only kept with NAMETABLE_STATS, so that otherwise find stores nothing at all;
+        //mutable since find is const, and they live next to the data find already touches
+        static constexpr bool COUNT_STATS = NAMETABLE_STATS != 0;
+        mutable unsigned long long finds;
+        mutable unsigned long long lookups;
+        mutable unsigned long long lookupProbes;
+        mutable unsigned long long chainSteps;
+        mutable unsigned long long filterRejects;
+        //While a transaction is open, everything that changes a declaration or a scope is logged, so it can be
+        //undone newest first. Sweeping would move declarations the log refers to, so it waits for the outermost
+        //transaction to end; dropping stale declarations is logged like any other pop.
+        struct undo{
+            enum Kind { DECLARED, POPPED, ENTERED, EXITED };
+            Kind m_Kind;
+            SymbolId m_Sym;//DECLARED and POPPED
+            declaration m_Old;//POPPED: the declaration to put back on the front of the chain
+            scope m_Scope;//EXITED: the scope to reopen
+        };
+        std::vector<undo> undoLog;
+        std::vector<size_t> marks;//where each open transaction starts in undoLog, innermost last
+        size_t probe(std::string_view id, size_t h) const;//returns the slot holding id, or the empty slot where it would go
+        void grow();
+        bool isSymbol(SymbolId sym) const;
+        bool isLive(int depth, std::uint64_t epoch) const;//is the scope this declaration was made in still open?
+        void popDeclaration(symbol& s);//uncovers whatever the innermost declaration shadowed
+        void logPop(symbol& s);//in a transaction, saves the innermost declaration before it is popped
+        void pushDeclaration(symbol& s, declaration d);//puts a popped declaration back on the front of the chain
+        void undoOne(undo& u);
+        void dropStale(symbol& s);//pops declarations from closed scopes off the front of the shadow chain
+        void sweep();//drops every stale declaration and compacts the arena
+        static std::uint64_t filterBits(size_t h);
+        size_t filterBlockOf(std::uint64_t bits) const;
+        void filterAdd(size_t h);//the symbol with this hash now has a declaration
+        void filterRemove(size_t h);//and now it has none
+        bool mayBeDeclared(size_t h) const;
+        void rebuildFilter();
+        template<typename T>
+        static void shrinkIfSparse(std::vector<T>& v);
+        template<typename T>
+        static size_t bytesOf(const std::vector<T>& v);
+public:
+    HashTable(bool lazy);
+    static size_t hashOf(std::string_view id);
+    SymbolId lookup(std::string_view id) const;//returns the symbol for this name, or -1 if it has never been interned
+    SymbolId lookup(std::string_view id, size_t h) const;//same, when the caller already hashed id
+    SymbolId lookupDeclared(std::string_view id, size_t h) const;//same, but -1 at once for a name the filter rules out
+    SymbolId intern(std::string_view id);//returns the symbol for this name, adding it if it is new
+    void prefetchSlot(size_t h) const;//starts pulling the filter block and the slot a hash starts probing at into the cache
+    const V* find(SymbolId sym) const;//returns the value of the innermost live declaration, or nullptr
+    void prefetch(SymbolId sym) const;//starts pulling a symbol's record into the cache
+    bool insert(SymbolId sym, const int depth, V value);//pushes the declaration on top of its symbol's shadow chain
+    void newScope();
+    void destroyScope();//pops every declaration of the innermost scope off its shadow chain, or just forgets the scope
+    void stats(NameTableStats& st) const;
+    size_t symbolCount() const;
+    size_t scopeCount() const;
+    void beginTransaction();
+    bool commitTransaction();
+    bool rollbackTransaction();//undoes everything since the innermost open transaction began
+    template<typename F>
+    void forEachVisible(F f) const;//calls f(sym, name, hash, value) for every symbol's innermost live declaration
+};
+
+template<typename V, typename Hash>
+HashTable<V, Hash>::HashTable(bool lazy) : outermostHead(-1), lazyExit(lazy), nextEpoch(1), sweepAt(MIN_SWEEP),
+    finds(0), lookups(0), lookupProbes(0), chainSteps(0), filterRejects(0)
+{}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::isSymbol(SymbolId sym) const
+{
+    return sym >= 0 && sym < static_cast<SymbolId>(symbols.size());
+}
+
+template<typename V, typename Hash>
+size_t HashTable<V, Hash>::hashOf(std::string_view id)
+{
+    return Hash()(id);
+}
+
+template<typename V, typename Hash>
+size_t HashTable<V, Hash>::probe(std::string_view id, size_t h) const
+{
+    size_t mask = control.size() - 1;
+    unsigned char tag = FULL | (h & 0x7f);
+    for(size_t i = (h >> 7) & mask; ; i = (i + 1) & mask){
+        if(control[i] == EMPTY)
+            return i;
+        if(control[i] == tag){
+            const symbol& s = symbols[slots[i]];
+            if(id == std::string_view(&names[s.m_NameStart], s.m_NameLength))
+                return i;
+        }
+    }
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::grow()
+{//double the slots; every symbol remembers its full hash, so no spelling is hashed again
+    size_t capacity = control.empty() ? INITIAL_SLOTS : control.size() * 2;
+    control.assign(capacity, EMPTY);
+    slots.assign(capacity, -1);
+    for(SymbolId sym = 0; sym < static_cast<SymbolId>(symbols.size()); sym++){
+        size_t h = symbols[sym].m_Hash;
+        size_t i = (h >> 7) & (capacity - 1);
+        while(control[i] != EMPTY)
+            i = (i + 1) & (capacity - 1);
+        control[i] = FULL | (h & 0x7f);
+        slots[i] = sym;
+    }
+    rebuildFilter();
+}
+
+template<typename V, typename Hash>
+SymbolId HashTable<V, Hash>::lookup(std::string_view id) const
+{
+    return lookup(id, hashOf(id));
+}
+
+template<typename V, typename Hash>
+SymbolId HashTable<V, Hash>::lookup(std::string_view id, size_t h) const
+{
+    if(COUNT_STATS)
+        lookups++;
+    if(control.empty())
+        return -1;
+    size_t i = probe(id, h);
+    size_t mask = control.size() - 1;
+    if(COUNT_STATS)
+        lookupProbes += ((i - ((h >> 7) & mask)) & mask) + 1;//the probe ran from the home slot to i
+    return control[i] == EMPTY ? -1 : slots[i];
+}
+
+template<typename V, typename Hash>
+SymbolId HashTable<V, Hash>::lookupDeclared(std::string_view id, size_t h) const
+{
+#if defined(__GNUC__)
+    if(!control.empty())//start on the slot now, so a name that gets past the filter doesn't wait on it twice
+        __builtin_prefetch(&control[(h >> 7) & (control.size() - 1)]);
+#endif
+    if(!mayBeDeclared(h)){
+        if(COUNT_STATS)
+            filterRejects++;
+        return -1;
+    }
+    return lookup(id, h);
+}
+
+template<typename V, typename Hash>
+std::uint64_t HashTable<V, Hash>::filterBits(size_t h)
+{//remix the hash, so which counters a name gets has nothing to do with which slot it lands in
+    return static_cast<std::uint64_t>(h) * 0x9e3779b97f4a7c15;
+}
+
+template<typename V, typename Hash>
+size_t HashTable<V, Hash>::filterBlockOf(std::uint64_t bits) const
+{
+    return (bits >> 32) & (filter.size() - 1);
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::filterAdd(size_t h)
+{
+    std::uint64_t bits = filterBits(h);
+    filterBlock& b = filter[filterBlockOf(bits)];
+    for(int k = 0; k < FILTER_PROBES; k++){
+        unsigned c = (bits >> (7 * k)) & 127;
+        unsigned shift = (c & 1) * 4;
+        if(((b.m_Counters[c >> 1] >> shift) & 0xf) != 0xf)
+            b.m_Counters[c >> 1] += 1 << shift;
+    }
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::filterRemove(size_t h)
+{
+    std::uint64_t bits = filterBits(h);
+    filterBlock& b = filter[filterBlockOf(bits)];
+    for(int k = 0; k < FILTER_PROBES; k++){
+        unsigned c = (bits >> (7 * k)) & 127;
+        unsigned shift = (c & 1) * 4;
+        unsigned n = (b.m_Counters[c >> 1] >> shift) & 0xf;
+        if(n != 0 && n != 0xf)//a saturated counter no longer knows how many names it holds, so it stays put
+            b.m_Counters[c >> 1] -= 1 << shift;
+    }
+}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::mayBeDeclared(size_t h) const
+{
+    if(filter.empty())
+        return false;//nothing has even been interned
+    std::uint64_t bits = filterBits(h);
+    const filterBlock& b = filter[filterBlockOf(bits)];
+    for(int k = 0; k < FILTER_PROBES; k++){
+        unsigned c = (bits >> (7 * k)) & 127;
+        if(((b.m_Counters[c >> 1] >> ((c & 1) * 4)) & 0xf) == 0)
+            return false;
+    }
+    return true;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::rebuildFilter()
+{
+    filter.assign(std::max<size_t>(1, control.size() / SLOTS_PER_FILTER_BLOCK), filterBlock());
+    for(const symbol& s : symbols){
+        if(s.m_Depth != -1)
+            filterAdd(s.m_Hash);
+    }
+}
+
+template<typename V, typename Hash>
+SymbolId HashTable<V, Hash>::intern(std::string_view id)
+{
+    if(control.empty())
+        grow();
+    size_t h = hashOf(id);
+    size_t i = probe(id, h);
+    if(control[i] != EMPTY)
+        return slots[i];
+    SymbolId sym = static_cast<SymbolId>(symbols.size());
+    symbol s = { h, static_cast<unsigned>(names.size()), static_cast<unsigned>(id.size()), V(), -1, -1, -1, 0 };
+    symbols.push_back(std::move(s));
+    names.insert(names.end(), id.begin(), id.end());
+    control[i] = FULL | (h & 0x7f);
+    slots[i] = sym;
+    if(symbols.size() * 8 > control.size() * 7)//keep the load factor under 7/8
+        grow();
+    return sym;
+}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::isLive(int depth, std::uint64_t epoch) const
+{
+    if(depth == 0)
+        return true;//the outermost scope never closes
+    return depth <= static_cast<int>(scopes.size()) && scopes[depth-1].m_Epoch == epoch;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::popDeclaration(symbol& s)
+{
+    if(s.m_Shadowed == -1){
+        s.m_Value = V();//let go of whatever the value holds
+        s.m_Depth = -1;
+        filterRemove(s.m_Hash);
+        s.m_NextInScope = -1;
+        return;
+    }
+    declaration& outer = arena[s.m_Shadowed];//nothing else refers to it once it is uncovered
+    s.m_Value = std::move(outer.m_Value);
+    s.m_Depth = outer.m_Depth;
+    s.m_Shadowed = outer.m_Shadowed;
+    s.m_NextInScope = outer.m_NextInScope;
+    s.m_Epoch = outer.m_Epoch;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::logPop(symbol& s)
+{
+    if(marks.empty())
+        return;
+    undo u = { undo::POPPED, static_cast<SymbolId>(&s - symbols.data()),
+               { std::move(s.m_Value), s.m_Depth, s.m_Shadowed, s.m_NextInScope, s.m_Epoch }, scope() };
+    undoLog.push_back(std::move(u));
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::pushDeclaration(symbol& s, declaration d)
+{//the reverse of popDeclaration; what is uncovered now goes to the end of the arena, not necessarily back where it was
+    if(s.m_Depth != -1){
+        declaration outer = { std::move(s.m_Value), s.m_Depth, s.m_Shadowed, s.m_NextInScope, s.m_Epoch };
+        d.m_Shadowed = static_cast<int>(arena.size());
+        arena.push_back(std::move(outer));
+    }
+    else{
+        d.m_Shadowed = -1;
+        filterAdd(s.m_Hash);
+    }
+    s.m_Value = std::move(d.m_Value);
+    s.m_Depth = d.m_Depth;
+    s.m_Shadowed = d.m_Shadowed;
+    s.m_NextInScope = d.m_NextInScope;
+    s.m_Epoch = d.m_Epoch;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::dropStale(symbol& s)
+{//only the front of a chain can be stale: everything behind a live declaration was live when it was shadowed,
+ //and its scopes enclose the live one's, so they are all still open
+    while(s.m_Depth != -1 && !isLive(s.m_Depth, s.m_Epoch)){
+        logPop(s);
+        popDeclaration(s);
+    }
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::sweep()
+{
+    std::vector<declaration> live;
+    for(symbol& s : symbols){
+        dropStale(s);
+        int from = s.m_Shadowed;
+        if(from == -1)
+            continue;
+        s.m_Shadowed = static_cast<int>(live.size());
+        while(from != -1){//move the rest of the chain, keeping it linked
+            declaration d = std::move(arena[from]);
+            from = d.m_Shadowed;
+            d.m_Shadowed = from == -1 ? -1 : static_cast<int>(live.size()) + 1;
+            live.push_back(std::move(d));
+        }
+    }
+    arena.swap(live);
+    rebuildFilter();//clears counters that saturated
+    sweepAt = std::max(std::max(MIN_SWEEP, 2 * arena.size()), symbols.size());//keeps sweeping amortized O(1) per declaration
+}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::insert(SymbolId sym, const int depth, V value)
+{
+    if(!isSymbol(sym))
+        return false;
+    symbol& s = symbols[sym];
+    if(lazyExit)
+        dropStale(s);
+    if(s.m_Depth == depth)
+        return false;//already declared in this scope
+    if(s.m_Depth != -1){//move the declaration being shadowed out of the way
+        declaration outer = { std::move(s.m_Value), s.m_Depth, s.m_Shadowed, s.m_NextInScope, s.m_Epoch };
+        s.m_Shadowed = static_cast<int>(arena.size());
+        arena.push_back(std::move(outer));
+    }
+    else
+        filterAdd(s.m_Hash);
+    s.m_Value = std::move(value);
+    s.m_Depth = depth;
+    s.m_Epoch = scopes.empty() ? 0 : scopes.back().m_Epoch;
+    if(!lazyExit){//lazy scopes are never walked, so they don't need their lists
+        SymbolId& head = scopes.empty() ? outermostHead : scopes.back().m_Head;
+        s.m_NextInScope = head;
+        head = sym;
+    }
+    if(!marks.empty())
+        undoLog.push_back(undo{ undo::DECLARED, sym, declaration(), scope() });
+    else if(lazyExit && arena.size() >= sweepAt)
+        sweep();
+    return true;
+}
+
+template<typename V, typename Hash>
+const V* HashTable<V, Hash>::find(SymbolId sym) const
+{//the innermost live declaration is the one that is visible from the current scope
+    if(COUNT_STATS)
+        finds++;
+    if(!isSymbol(sym) || symbols[sym].m_Depth == -1)
+        return nullptr;
+    const symbol& s = symbols[sym];
+    if(!lazyExit || isLive(s.m_Depth, s.m_Epoch))
+        return &s.m_Value;
+    for(int d = s.m_Shadowed; d != -1; d = arena[d].m_Shadowed){
+        if(COUNT_STATS)
+            chainSteps++;//past one more stale declaration
+        if(isLive(arena[d].m_Depth, arena[d].m_Epoch))
+            return &arena[d].m_Value;
+    }
+    return nullptr;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::prefetchSlot(size_t h) const
+{
+#if defined(__GNUC__)
+    if(!control.empty()){
+        size_t i = (h >> 7) & (control.size() - 1);
+        __builtin_prefetch(&filter[filterBlockOf(filterBits(h))]);
+        __builtin_prefetch(&control[i]);
+        __builtin_prefetch(&slots[i]);
+    }
+#else
+    (void)h;
+#endif
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::prefetch(SymbolId sym) const
+{
+#if defined(__GNUC__)
+    if(isSymbol(sym))
+        __builtin_prefetch(&symbols[sym]);
+#else
+    (void)sym;
+#endif
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::newScope()
+{
+    scope sc = { -1, static_cast<int>(arena.size()), nextEpoch };
+    scopes.push_back(sc);
+    if(!marks.empty())
+        undoLog.push_back(undo{ undo::ENTERED, -1, declaration(), scope() });
+    nextEpoch++;
+}
+
+template<typename V, typename Hash>
+template<typename T>
+void HashTable<V, Hash>::shrinkIfSparse(std::vector<T>& v)
+{//give memory back after a very deep nest unwinds, but only when it would halve several times over
+    if(v.capacity() > 1024 && v.size() * 4 < v.capacity())
+        v.shrink_to_fit();
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::destroyScope()//pops all of the declarations of the innermost scope, uncovering whatever they shadowed
+{
+    if(!marks.empty())
+        undoLog.push_back(undo{ undo::EXITED, -1, declaration(), scopes.back() });
+    if(lazyExit){
+        scopes.pop_back();
+        shrinkIfSparse(scopes);
+        return;
+    }
+    SymbolId sym = scopes.back().m_Head;
+    size_t arenaStart = scopes.back().m_ArenaStart;
+    scopes.pop_back();
+    while(sym != -1){
+        symbol& s = symbols[sym];
+        sym = s.m_NextInScope;
+        logPop(s);
+        popDeclaration(s);
+    }
+    arena.resize(arenaStart);//for a V like int there is nothing to destroy, so this just moves the end back
+    shrinkIfSparse(arena);
+    shrinkIfSparse(scopes);
+}
+
+template<typename V, typename Hash>
+template<typename T>
+size_t HashTable<V, Hash>::bytesOf(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::stats(NameTableStats& st) const
+{//walks every slot and every shadow chain; this is for diagnostics, not for the hot path
+    st.symbols = symbols.size();
+    st.slots = control.size();
+    st.loadFactor = control.empty() ? 0 : static_cast<double>(symbols.size()) / control.size();
+    st.probeLengths.clear();
+    for(size_t i = 0; i < control.size(); i++){
+        if(control[i] == EMPTY)
+            continue;
+        size_t mask = control.size() - 1;
+        size_t distance = (i - ((symbols[slots[i]].m_Hash >> 7) & mask)) & mask;
+        if(st.probeLengths.size() <= distance)
+            st.probeLengths.resize(distance + 1);
+        st.probeLengths[distance]++;
+    }
+    st.liveDeclarations.assign(scopes.size() + 1, 0);
+    st.staleDeclarations = 0;
+    for(const symbol& s : symbols){
+        if(s.m_Depth == -1)
+            continue;
+        int depth = s.m_Depth;
+        std::uint64_t epoch = s.m_Epoch;
+        for(int d = s.m_Shadowed; ; d = arena[d].m_Shadowed){
+            if(isLive(depth, epoch))
+                st.liveDeclarations[depth]++;
+            else
+                st.staleDeclarations++;
+            if(d == -1)
+                break;
+            depth = arena[d].m_Depth;
+            epoch = arena[d].m_Epoch;
+        }
+    }
+    st.bytesUsed = sizeof(HashTable) + bytesOf(control) + bytesOf(slots) + bytesOf(symbols) +
+                   bytesOf(names) + bytesOf(arena) + bytesOf(scopes) + bytesOf(filter) +
+                   bytesOf(undoLog) + bytesOf(marks);
+    st.finds = finds;
+    st.lookups = lookups;
+    st.lookupProbes = lookupProbes;
+    st.chainSteps = chainSteps;
+    st.filterRejects = filterRejects;
+}
+
+template<typename V, typename Hash>
+size_t HashTable<V, Hash>::symbolCount() const
+{
+    return symbols.size();
+}
+
+template<typename V, typename Hash>
+size_t HashTable<V, Hash>::scopeCount() const
+{
+    return scopes.size();
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::beginTransaction()
+{
+    marks.push_back(undoLog.size());
+}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::commitTransaction()
+{//an inner transaction's changes stay logged, since the one around it may still be rolled back
+    if(marks.empty())
+        return false;
+    marks.pop_back();
+    if(marks.empty()){
+        undoLog.clear();
+        shrinkIfSparse(undoLog);
+        if(lazyExit && arena.size() >= sweepAt)
+            sweep();
+    }
+    return true;
+}
+
+template<typename V, typename Hash>
+bool HashTable<V, Hash>::rollbackTransaction()
+{
+    if(marks.empty())
+        return false;
+    while(undoLog.size() > marks.back()){
+        undoOne(undoLog.back());
+        undoLog.pop_back();
+    }
+    marks.pop_back();
+    if(marks.empty()){
+        shrinkIfSparse(undoLog);
+        if(lazyExit && arena.size() >= sweepAt)
+            sweep();
+    }
+    return true;
+}
+
+template<typename V, typename Hash>
+void HashTable<V, Hash>::undoOne(undo& u)
+{//everything logged after u has been undone already, so the table is just as u left it
+    switch(u.m_Kind){
+      case undo::DECLARED:{
+        symbol& s = symbols[u.m_Sym];
+        if(!lazyExit)
+            (scopes.empty() ? outermostHead : scopes.back().m_Head) = s.m_NextInScope;
+        bool onTop = s.m_Shadowed != -1 && s.m_Shadowed + 1 == static_cast<int>(arena.size());
+        popDeclaration(s);
+        if(onTop)//what insert pushed onto the arena
+            arena.pop_back();
+        break;
+      }
+      case undo::POPPED:
+        pushDeclaration(symbols[u.m_Sym], std::move(u.m_Old));
+        break;
+      case undo::ENTERED:
+        scopes.pop_back();
+        break;
+      case undo::EXITED:
+        scopes.push_back(u.m_Scope);
+        break;
+    }
+}
+
+template<typename V, typename Hash>
+template<typename F>
+void HashTable<V, Hash>::forEachVisible(F f) const
+{//the same search as find, but without counting anything
+    for(SymbolId sym = 0; sym < static_cast<SymbolId>(symbols.size()); sym++){
+        const symbol& s = symbols[sym];
+        if(s.m_Depth == -1)
+            continue;
+        const V* value = nullptr;
+        if(!lazyExit || isLive(s.m_Depth, s.m_Epoch))
+            value = &s.m_Value;
+        else{
+            for(int d = s.m_Shadowed; d != -1 && value == nullptr; d = arena[d].m_Shadowed){
+                if(isLive(arena[d].m_Depth, arena[d].m_Epoch))
+                    value = &arena[d].m_Value;
+            }
+        }
+        if(value != nullptr)
+            f(sym, std::string_view(&names[s.m_NameStart], s.m_NameLength), s.m_Hash, *value);
+    }
+}
+
+}  // namespace nametabledetail
+
+//*********** BasicNameTable implementation and functions **************
+//*********** BasicNameTable implementation and functions **************
+//*********** BasicNameTable implementation and functions **************
+//*********** BasicNameTable implementation and functions **************
+//*********** BasicNameTable implementation and functions **************
+
+template<typename V, typename Hash>
+class BasicNameTable
+{
+  public:
+    explicit BasicNameTable(ExitPolicy policy = EAGER_EXIT);
+    void enterScope();
+    bool exitScope();
+    SymbolId intern(std::string_view id);
+    bool declare(std::string_view id, V value);
+    bool declare(SymbolId sym, V value);
+      // The pointer is good until the next non-const call; see above
+    const V* find(std::string_view id) const;
+    V* find(std::string_view id);
+    const V* find(SymbolId sym) const;
+    V* find(SymbolId sym);
+      // Looks up count names at once, storing what find would return for
+      // ids[k] in out[k].  The lookups are interleaved so their cache
+      // misses overlap, which pays off when resolving dozens of names.
+    void findMany(const std::string_view* ids, size_t count, const V** out) const;
+      // Starts pulling a symbol's declaration into the cache, for a loop
+      // that knows which symbols it will need a few iterations from now
+    void prefetch(SymbolId sym) const;
+    NameTableStats stats() const;
+      // See NameTable::begin
+    void begin();
+    bool commit();
+    bool rollback();
+      // A snapshot of what is visible right now; see BasicFrozenNameTable
+    BasicFrozenNameTable<V, Hash> freeze() const;
+      // We prevent a BasicNameTable object from being copied or assigned
+    BasicNameTable(const BasicNameTable&) = delete;
+    BasicNameTable& operator=(const BasicNameTable&) = delete;
+
+  private:
+    int scopeDepth;//line 1 starts at a scope of 0, then every new scope entered is one greater
+    nametabledetail::HashTable<V, Hash> hashy;
+    friend class BasicFrozenNameTable<V, Hash>;
+};
+
+template<typename V, typename Hash>
+BasicNameTable<V, Hash>::BasicNameTable(ExitPolicy policy) : scopeDepth(0), hashy(policy == LAZY_EXIT)
+{}
+
+template<typename V, typename Hash>
+void BasicNameTable<V, Hash>::enterScope()
+{
+    scopeDepth++;
+    hashy.newScope();
+}
+
+template<typename V, typename Hash>
+bool BasicNameTable<V, Hash>::exitScope()
+{
+    if(scopeDepth>0){//if you can exit the scope
+        hashy.destroyScope();
+        scopeDepth--;
+        return true;
+    }
+    return false;
+}
+
+template<typename V, typename Hash>
+SymbolId BasicNameTable<V, Hash>::intern(std::string_view id)
+{//the empty string can never be declared, so it never gets a symbol
+    if(id.empty())
+        return -1;
+    return hashy.intern(id);
+}
+
+template<typename V, typename Hash>
+bool BasicNameTable<V, Hash>::declare(std::string_view id, V value)
+{
+    return declare(intern(id), std::move(value));
+}
+
+template<typename V, typename Hash>
+bool BasicNameTable<V, Hash>::declare(SymbolId sym, V value)
+{
+    return hashy.insert(sym, scopeDepth, std::move(value));
+}
+
+template<typename V, typename Hash>
+const V* BasicNameTable<V, Hash>::find(std::string_view id) const
+{
+    return hashy.find(hashy.lookupDeclared(id, hashy.hashOf(id)));
+}
+
+template<typename V, typename Hash>
+V* BasicNameTable<V, Hash>::find(std::string_view id)
+{
+    return const_cast<V*>(static_cast<const BasicNameTable&>(*this).find(id));
+}
+
+template<typename V, typename Hash>
+const V* BasicNameTable<V, Hash>::find(SymbolId sym) const
+{
+    return hashy.find(sym);
+}
+
+template<typename V, typename Hash>
+V* BasicNameTable<V, Hash>::find(SymbolId sym)
+{
+    return const_cast<V*>(hashy.find(sym));
+}
+
+template<typename V, typename Hash>
+void BasicNameTable<V, Hash>::findMany(const std::string_view* ids, size_t count, const V** out) const
+{//each group goes through in three passes, so the cache misses of one pass overlap instead of
+ //being paid one name at a time: hash every name and prefetch its first slot, then probe for
+ //every symbol and prefetch its record, then read off the values
+    const size_t GROUP = 16;//how many names are in flight at once
+    size_t hashes[GROUP];
+    SymbolId syms[GROUP];
+    for(size_t start = 0; start < count; start += GROUP){
+        size_t n = std::min(GROUP, count - start);
+        for(size_t k = 0; k < n; k++){
+            hashes[k] = hashy.hashOf(ids[start + k]);
+            hashy.prefetchSlot(hashes[k]);
+        }
+        for(size_t k = 0; k < n; k++){
+            syms[k] = hashy.lookupDeclared(ids[start + k], hashes[k]);
+            hashy.prefetch(syms[k]);
+        }
+        for(size_t k = 0; k < n; k++)
+            out[start + k] = hashy.find(syms[k]);
+    }
+}
+
+template<typename V, typename Hash>
+void BasicNameTable<V, Hash>::prefetch(SymbolId sym) const
+{
+    hashy.prefetch(sym);
+}
+
+template<typename V, typename Hash>
+NameTableStats BasicNameTable<V, Hash>::stats() const
+{
+    NameTableStats st;
+    hashy.stats(st);
+    st.bytesUsed += sizeof(BasicNameTable) - sizeof(hashy);
+    return st;
+}
+
+template<typename V, typename Hash>
+void BasicNameTable<V, Hash>::begin()
+{
+    hashy.beginTransaction();
+}
+
+template<typename V, typename Hash>
+bool BasicNameTable<V, Hash>::commit()
+{
+    return hashy.commitTransaction();
+}
+
+template<typename V, typename Hash>
+bool BasicNameTable<V, Hash>::rollback()
+{
+    if(!hashy.rollbackTransaction())
+        return false;
+    scopeDepth = static_cast<int>(hashy.scopeCount());
+    return true;
+}
+
+template<typename V, typename Hash>
+BasicFrozenNameTable<V, Hash> BasicNameTable<V, Hash>::freeze() const
+{
+    return BasicFrozenNameTable<V, Hash>(*this);
+}
+
+//*********** BasicFrozenNameTable implementation and functions **************
+//*********** BasicFrozenNameTable implementation and functions **************
+//*********** BasicFrozenNameTable implementation and functions **************
+//*********** BasicFrozenNameTable implementation and functions **************
+//*********** BasicFrozenNameTable implementation and functions **************
+
+  // A BasicFrozenNameTable holds copies of the declarations a table could
+  // see when it was frozen, laid out for lookup and nothing else: no
+  // scopes, no shadowed declarations, no counters.  Nothing changes it
+  // after it is built, so any number of threads can call find on the same
+  // one at once without locks, and a SymbolId from the table it was made
+  // from still finds the same name.  V must be copyable.
+
+template<typename V, typename Hash>
+class BasicFrozenNameTable
+{
+  public:
+    explicit BasicFrozenNameTable(const BasicNameTable<V, Hash>& table);
+    const V* find(std::string_view id) const;
+    const V* find(SymbolId sym) const;
+    size_t size() const;//how many names are visible
+    size_t bytesUsed() const;
+  private:
+    struct entry{//entries are stored in slot order, so a probe walks through them in order too
+        unsigned m_NameStart;
+        unsigned m_NameLength;
+        V m_Value;
+    };
+    static constexpr unsigned char EMPTY = 0;
+    static constexpr unsigned char FULL = 0x80;
+    std::vector<unsigned char> control;//EMPTY or FULL plus 7 bits of the hash, as in the live table
+    std::vector<int> slots;//index into entries
+    std::vector<entry> entries;
+    std::vector<char> names;
+    std::vector<int> bySymbol;//SymbolId to index into entries, or -1
+};
+
+template<typename V, typename Hash>
+BasicFrozenNameTable<V, Hash>::BasicFrozenNameTable(const BasicNameTable<V, Hash>& table)
+{
+    struct visible{
+        SymbolId m_Sym;
+        std::string_view m_Name;
+        size_t m_Hash;
+        const V* m_Value;
+    };
+    std::vector<visible> found;
+    table.hashy.forEachVisible([&found](SymbolId sym, std::string_view name, size_t h, const V& value){
+        found.push_back(visible{ sym, name, h, &value });
+    });
+    bySymbol.assign(table.hashy.symbolCount(), -1);
+    if(found.empty())
+        return;
+    size_t capacity = 16;
+    while(found.size() * 8 > capacity * 7)
+        capacity *= 2;
+    control.assign(capacity, EMPTY);
+    std::vector<int> placed(capacity, -1);//which of found goes in each slot
+    for(size_t k = 0; k < found.size(); k++){
+        size_t i = (found[k].m_Hash >> 7) & (capacity - 1);
+        while(control[i] != EMPTY)
+            i = (i + 1) & (capacity - 1);
+        control[i] = FULL | (found[k].m_Hash & 0x7f);
+        placed[i] = static_cast<int>(k);
+    }
+    slots.assign(capacity, -1);
+    entries.reserve(found.size());
+    for(size_t i = 0; i < capacity; i++){
+        if(placed[i] == -1)
+            continue;
+        const visible& v = found[placed[i]];
+        slots[i] = static_cast<int>(entries.size());
+        bySymbol[v.m_Sym] = static_cast<int>(entries.size());
+        entries.push_back(entry{ static_cast<unsigned>(names.size()), static_cast<unsigned>(v.m_Name.size()), *v.m_Value });
+        names.insert(names.end(), v.m_Name.begin(), v.m_Name.end());
+    }
+}
+
+template<typename V, typename Hash>
+const V* BasicFrozenNameTable<V, Hash>::find(std::string_view id) const
+{
+    if(control.empty())
+        return nullptr;
+    size_t h = Hash()(id);
+    size_t mask = control.size() - 1;
+    unsigned char tag = FULL | (h & 0x7f);
+    for(size_t i = (h >> 7) & mask; control[i] != EMPTY; i = (i + 1) & mask){
+        if(control[i] == tag){
+            const entry& e = entries[slots[i]];
+            if(id == std::string_view(&names[e.m_NameStart], e.m_NameLength))
+                return &e.m_Value;
+        }
+    }
+    return nullptr;
+}
+
+template<typename V, typename Hash>
+const V* BasicFrozenNameTable<V, Hash>::find(SymbolId sym) const
+{
+    if(sym < 0 || sym >= static_cast<SymbolId>(bySymbol.size()) || bySymbol[sym] == -1)
+        return nullptr;
+    return &entries[bySymbol[sym]].m_Value;
+}
+
+template<typename V, typename Hash>
+size_t BasicFrozenNameTable<V, Hash>::size() const
+{
+    return entries.size();
+}
+
+template<typename V, typename Hash>
+size_t BasicFrozenNameTable<V, Hash>::bytesUsed() const
+{
+    return sizeof(BasicFrozenNameTable) + control.capacity() + slots.capacity() * sizeof(int) +
+           entries.capacity() * sizeof(entry) + names.capacity() + bySymbol.capacity() * sizeof(int);
+}
+
+#endif // BASICNAMETABLE_INCLUDED
@@ -0,0 +1,447 @@
+#include "CommandFile.h"
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <iterator>
+
+#if defined(_WIN32)
+#define COMMANDFILE_NO_MMAP
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+CommandFile::CommandFile()
+ : m_data(nullptr), m_size(0), m_mapped(false), m_binary(false),
+   m_commandsStart(nullptr), m_cursor(nullptr), m_count(0), m_done(true), m_failed(false)
+{}
+
+CommandFile::~CommandFile()
+{
+    unload();
+}
+
+void CommandFile::unload()
+{
+#ifndef COMMANDFILE_NO_MMAP
+    if (m_mapped)
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_binary = false;
+    m_commandsStart = nullptr;
+    m_cursor = nullptr;
+    m_count = 0;
+    m_done = true;
+    m_failed = false;
+    m_buffer.clear();
+    m_commands.clear();
+    m_strings.clear();
+}
+
+bool CommandFile::map(const char* path)
+{
+    unload();
+#ifndef COMMANDFILE_NO_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size > 0)
+    {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            m_data = static_cast<const char*>(p);
+            m_size = st.st_size;
+            m_mapped = true;
+#ifdef MADV_SEQUENTIAL
+            madvise(p, m_size, MADV_SEQUENTIAL);
+#endif
+        }
+    }
+    ::close(fd);
+    if (!m_mapped  &&  st.st_size > 0)
+#endif
+    {
+          // No mapping available, so read the whole file in one go instead
+        ifstream f(path, ios::binary);
+        if ( ! f)
+            return false;
+        m_buffer.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+    m_binary = (m_size >= TRACE_MAGIC_SIZE  &&  memcmp(m_data, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0);
+    m_commandsStart = m_data;
+    if (m_binary  &&  !decodeStrings())
+    {
+        unload();
+        return false;
+    }
+    rewind();
+    return true;
+}
+
+bool CommandFile::load(const char* path)
+{
+    if (!map(path))
+        return false;
+    if (m_binary)
+    {
+        if (!decode())
+        {
+            unload();
+            return false;
+        }
+        return true;
+    }
+    tokenize();
+    return true;
+}
+
+bool CommandFile::open(const char* path)
+{
+    return map(path);
+}
+
+void CommandFile::rewind()
+{
+    m_cursor = m_commandsStart;
+    m_count = 0;
+    m_done = false;
+    m_failed = false;
+}
+
+size_t CommandFile::next(vector<CommandRecord>& chunk, size_t max)
+{
+    chunk.clear();
+    const char* end = m_data + m_size;
+    CommandRecord rec;
+    while (!m_done  &&  chunk.size() < max)
+    {
+        if (m_binary)
+        {
+            int status = readBinary(m_cursor, m_count, rec);
+            if (status <= 0)
+            {
+                m_done = true;
+                if (status < 0)
+                {
+                    m_failed = true;
+                    chunk.clear();
+                }
+                break;
+            }
+        }
+        else if (!readText(m_cursor, m_count, rec))
+        {
+            m_done = true;
+            break;
+        }
+        chunk.push_back(rec);
+    }
+    if (!m_binary  &&  m_cursor == end)
+        m_done = true;
+    return chunk.size();
+}
+
+static bool isSpace(char c)
+{
+    return c == ' '  ||  (c >= '\t'  &&  c <= '\r');
+}
+
+  // Parses an int the way istream's >> does: an optional sign and at least
+  // one digit, stopping at the first non-digit, and failing on overflow.
+
+static bool parseInt(const char* p, const char* end, int& value)
+{
+    bool negative = false;
+    if (p != end  &&  (*p == '+'  ||  *p == '-'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end  ||  *p < '0'  ||  *p > '9')
+        return false;
+    long long v = 0;
+    for ( ; p != end  &&  *p >= '0'  &&  *p <= '9'; p++)
+    {
+        v = v * 10 + (*p - '0');
+        if (v > static_cast<long long>(INT_MAX) + 1)
+            return false;
+    }
+    if (negative)
+        v = -v;
+    if (v > INT_MAX  ||  v < INT_MIN)
+        return false;
+    value = static_cast<int>(v);
+    return true;
+}
+
+bool parseCommandLine(string_view line, CommandRecord& rec)
+{
+    const char* q = line.data();
+    const char* eol = q + line.size();
+    while (q != eol  &&  isSpace(*q))
+        q++;
+    if (q == eol)
+        return false;
+    const char* idStart = q;
+    while (q != eol  &&  !isSpace(*q))
+        q++;
+    rec.id = string_view(idStart, q - idStart);
+    rec.idIndex = -1;
+    rec.lineNum = 0;
+    while (q != eol  &&  isSpace(*q))
+        q++;
+    if (rec.id == "{")
+        rec.op = CommandBatch::ENTER_SCOPE;
+    else if (rec.id == "}")
+        rec.op = CommandBatch::EXIT_SCOPE;
+    else if (parseInt(q, eol, rec.lineNum))
+        rec.op = CommandBatch::DECLARE;
+    else
+        rec.op = CommandBatch::FIND;
+    if (rec.op == CommandBatch::ENTER_SCOPE  ||  rec.op == CommandBatch::EXIT_SCOPE)
+        rec.id = string_view();
+    return true;
+}
+
+bool CommandFile::readText(const char*& p, int& lineno, CommandRecord& rec) const
+{
+    const char* end = m_data + m_size;
+    while (p != end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr)
+            eol = end;
+        lineno++;
+
+        string_view line(p, eol - p);
+        p = (eol == end ? end : eol + 1);
+        if (parseCommandLine(line, rec))
+        {
+            rec.lineno = lineno;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandFile::tokenize()
+{
+    size_t lines = 0;
+    for (const char* q = m_data; q != m_data + m_size; q++)
+        lines += (*q == '\n');
+    m_commands.reserve(lines + 1);
+
+    const char* p = m_data;
+    int lineno = 0;
+    CommandRecord rec;
+    while (readText(p, lineno, rec))
+        m_commands.push_back(rec);
+}
+
+static bool getVarint(const char*& p, const char* end, unsigned long long& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+            return false;
+        unsigned char b = *p++;
+        v |= static_cast<unsigned long long>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool CommandFile::decodeStrings()
+{
+    const char* p = m_data + TRACE_MAGIC_SIZE;
+    const char* end = m_data + m_size;
+
+    unsigned long long count;
+    if (!getVarint(p, end, count)  ||  count > static_cast<unsigned long long>(end - p))
+        return false;
+    m_strings.reserve(count);
+    for (unsigned long long k = 0; k < count; k++)
+    {
+        unsigned long long len;
+        if (!getVarint(p, end, len)  ||  len > static_cast<unsigned long long>(end - p))
+            return false;
+        m_strings.push_back(string_view(p, len));
+        p += len;
+    }
+    m_commandsStart = p;
+    return true;
+}
+
+int CommandFile::readBinary(const char*& p, int& count, CommandRecord& rec) const
+{
+    const char* end = m_data + m_size;
+    if (p == end)
+        return -1;
+    unsigned char op = *p++;
+    if (op == TRACE_END)
+        return 0;
+    rec.op = op;
+    rec.lineNum = 0;
+    rec.lineno = ++count;
+    rec.idIndex = -1;
+    rec.id = string_view();
+    if (op == CommandBatch::DECLARE  ||  op == CommandBatch::FIND)
+    {
+        unsigned long long index;
+        if (!getVarint(p, end, index)  ||  index >= m_strings.size())
+            return -1;
+        rec.idIndex = static_cast<int>(index);
+        rec.id = m_strings[index];
+        if (op == CommandBatch::DECLARE)
+        {
+            unsigned long long zz;
+            if (!getVarint(p, end, zz))
+                return -1;
+            rec.lineNum = static_cast<int>((zz >> 1) ^ (~(zz & 1) + 1));
+        }
+    }
+    else if (op != CommandBatch::ENTER_SCOPE  &&  op != CommandBatch::EXIT_SCOPE)
+        return -1;
+    return 1;
+}
+
+bool CommandFile::decode()
+{
+      // Decode the commands twice: once to check them and count them, so
+      // the records can be allocated all at once, and once to keep them
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const char* p = m_commandsStart;
+        int count = 0;
+        CommandRecord rec;
+        int status;
+        while ((status = readBinary(p, count, rec)) > 0)
+        {
+            if (pass == 1)
+                m_commands.push_back(rec);
+        }
+        if (status < 0)
+            return false;
+        if (pass == 0)
+            m_commands.reserve(count);
+    }
+    return true;
+}
+
+//========================================================================
+// TraceWriter
+//========================================================================
+
+const size_t TRACE_BUFFER_SIZE = 1 << 16;
+
+TraceWriter::TraceWriter(ostream& out, const vector<string_view>& strings)
+ : m_out(out), m_finished(false)
+{
+    m_buffer.reserve(TRACE_BUFFER_SIZE + 32);
+    m_out.write(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    putVarint(strings.size());
+    for (size_t k = 0; k < strings.size(); k++)
+    {
+        putVarint(strings[k].size());
+        flush();
+        m_out.write(strings[k].data(), strings[k].size());
+    }
+}
+
+TraceWriter::~TraceWriter()
+{
+    if (!m_finished)
+        finish();
+}
+
+void TraceWriter::putByte(unsigned char b)
+{
+    m_buffer.push_back(static_cast<char>(b));
+}
+
+void TraceWriter::putVarint(unsigned long long v)
+{
+    while (v >= 0x80)
+    {
+        putByte(static_cast<unsigned char>(v | 0x80));
+        v >>= 7;
+    }
+    putByte(static_cast<unsigned char>(v));
+}
+
+void TraceWriter::flush()
+{
+    m_out.write(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+}
+
+void TraceWriter::enterScope()
+{
+    putByte(CommandBatch::ENTER_SCOPE);
+    if (m_buffer.size() >= TRACE_BUFFER_SIZE)
+        flush();
+}
+
+void TraceWriter::exitScope()
+{
+    putByte(CommandBatch::EXIT_SCOPE);
+    if (m_buffer.size() >= TRACE_BUFFER_SIZE)
+        flush();
+}
+
+void TraceWriter::declare(int idIndex, int lineNum)
+{
+    putByte(CommandBatch::DECLARE);
+    putVarint(static_cast<unsigned>(idIndex));
+    unsigned long long zz = static_cast<unsigned long long>(static_cast<long long>(lineNum)) << 1;
+    putVarint(lineNum < 0 ? ~zz : zz);  // zigzag, so small negative numbers stay short
+    if (m_buffer.size() >= TRACE_BUFFER_SIZE)
+        flush();
+}
+
+void TraceWriter::find(int idIndex)
+{
+    putByte(CommandBatch::FIND);
+    putVarint(static_cast<unsigned>(idIndex));
+    if (m_buffer.size() >= TRACE_BUFFER_SIZE)
+        flush();
+}
+
+void TraceWriter::write(const CommandRecord& rec)
+{
+    switch (rec.op)
+    {
+      case CommandBatch::ENTER_SCOPE:  enterScope();                      break;
+      case CommandBatch::EXIT_SCOPE:   exitScope();                       break;
+      case CommandBatch::DECLARE:      declare(rec.idIndex, rec.lineNum); break;
+      case CommandBatch::FIND:         find(rec.idIndex);                 break;
+    }
+}
+
+bool TraceWriter::finish()
+{
+    putByte(TRACE_END);
+    flush();
+    m_out.flush();
+    m_finished = true;
+    return static_cast<bool>(m_out);
+}
@@ -0,0 +1,126 @@
+#ifndef COMMANDFILE_INCLUDED
+#define COMMANDFILE_INCLUDED
+
+#include "NameTable.h"
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+  // One command from a command file.  op is one of the CommandBatch::Op
+  // values, lineNum is only meaningful for DECLARE, and lineno is the line
+  // of the file the command came from (or the command's position, for a
+  // binary trace).  id points into the loaded file itself, so it is only
+  // good while the CommandFile is.  For a binary trace, idIndex is id's
+  // position in the trace's string table; otherwise it is -1.
+struct CommandRecord
+{
+    unsigned char op;
+    int lineNum;
+    int lineno;
+    int idIndex;
+    std::string_view id;
+};
+
+  // Besides the text format, a command file can be a binary trace, which
+  // is much smaller and needs no parsing of numbers or splitting of lines:
+  //
+  //   the 8 bytes "NTTRACE1"
+  //   a varint count of strings, then each string as a varint length
+  //     followed by its bytes
+  //   the commands, each an opcode byte (a CommandBatch::Op) followed,
+  //     for DECLARE, by a varint string index and a zigzag varint line
+  //     number, and for FIND by a varint string index
+  //   the opcode byte TRACE_END
+  //
+  // Varints are little-endian base 128, 7 bits per byte, high bit set on
+  // every byte but the last.
+
+const char TRACE_MAGIC[] = "NTTRACE1";
+const size_t TRACE_MAGIC_SIZE = 8;
+const unsigned char TRACE_END = 0xff;
+
+  // A CommandFile maps a command file (text or binary) into memory and
+  // tokenizes it in place, so loading costs one allocation for the whole
+  // file instead of a few per line.  Text lines are interpreted exactly
+  // like the tester's Command::create does.
+class CommandFile
+{
+  public:
+    CommandFile();
+    ~CommandFile();
+    bool load(const char* path);  // false if the file can't be read or is a corrupt trace
+      // Instead of load, open maps the file without making any records, and
+      // next then hands out the commands a chunk at a time, so only the
+      // mapping and one chunk are in memory no matter how long the file is.
+      // next replaces chunk's contents with up to max commands and returns
+      // how many there are, 0 at the end (or once a corrupt command is found
+      // in a trace, after which failed returns true).  rewind starts over.
+    bool open(const char* path);
+    size_t next(std::vector<CommandRecord>& chunk, size_t max);
+    bool failed() const { return m_failed; }
+    void rewind();
+    bool isBinary() const { return m_binary; }
+    const std::vector<CommandRecord>& commands() const { return m_commands; }
+      // A binary trace's string table; empty for a text file
+    const std::vector<std::string_view>& strings() const { return m_strings; }
+      // We prevent a CommandFile object from being copied or assigned
+    CommandFile(const CommandFile&) = delete;
+    CommandFile& operator=(const CommandFile&) = delete;
+
+  private:
+    void unload();
+    bool map(const char* path);
+    bool decodeStrings();
+    void tokenize();
+    bool decode();
+      // Read the command starting at or after p, moving p past it; count
+      // numbers the lines or commands read so far
+    bool readText(const char*& p, int& count, CommandRecord& rec) const;
+    int readBinary(const char*& p, int& count, CommandRecord& rec) const;  // 1, or 0 at the end, or -1 if corrupt
+    const char* m_data;
+    size_t m_size;
+    bool m_mapped;  // m_data is a mapping rather than m_buffer's contents
+    bool m_binary;
+    const char* m_commandsStart;  // where the commands begin, after any string table
+    const char* m_cursor;         // where next carries on from
+    int m_count;
+    bool m_done;
+    bool m_failed;
+    std::vector<char> m_buffer;
+    std::vector<CommandRecord> m_commands;
+    std::vector<std::string_view> m_strings;
+};
+
+  // Parses one line of a text command file the way CommandFile does,
+  // setting everything in rec but lineno (id points into line).  Returns
+  // false for a line with no command on it.
+bool parseCommandLine(std::string_view line, CommandRecord& rec);
+
+  // A TraceWriter writes a binary trace.  The string table has to be known
+  // up front, but the commands are streamed out through a buffer, so a
+  // trace can be far bigger than memory.  Call finish when done.
+class TraceWriter
+{
+  public:
+    TraceWriter(std::ostream& out, const std::vector<std::string_view>& strings);
+    ~TraceWriter();
+    void enterScope();
+    void exitScope();
+    void declare(int idIndex, int lineNum);
+    void find(int idIndex);
+    void write(const CommandRecord& rec);  // rec.idIndex must be set
+    bool finish();  // false if anything failed to be written
+      // We prevent a TraceWriter object from being copied or assigned
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+  private:
+    void putByte(unsigned char b);
+    void putVarint(unsigned long long v);
+    void flush();
+    std::ostream& m_out;
+    std::vector<char> m_buffer;
+    bool m_finished;
+};
+
+#endif // COMMANDFILE_INCLUDED
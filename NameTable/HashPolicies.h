@@ -0,0 +1,158 @@
+#ifndef HASHPOLICIES_INCLUDED
+#define HASHPOLICIES_INCLUDED
+
+// Hash policies for NameTable's symbol index.  Each one is a function
+// object like std::hash<std::string_view>, which is itself a valid policy.
+// The index takes its home slot from the bits above the low 7 and keeps
+// the low 7 as a tag, so a policy's low bits must be as good as its high
+// ones.  BasicNameTable.h picks one at compile time with NAMETABLE_HASH:
+//
+//     g++ -std=c++17 -O2 -DNAMETABLE_HASH=Fnv1aHash ...
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace hashdetail
+{
+    inline std::uint64_t read8(const char* p)
+    {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    inline std::uint64_t read4(const char* p)
+    {
+        std::uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+      // The 128-bit product of a and b, folded to 64 bits
+    inline std::uint64_t mum(std::uint64_t a, std::uint64_t b)
+    {
+#if defined(__SIZEOF_INT128__)
+        unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+        return static_cast<std::uint64_t>(r) ^ static_cast<std::uint64_t>(r >> 64);
+#else
+        std::uint64_t ha = a >> 32, la = a & 0xffffffff;
+        std::uint64_t hb = b >> 32, lb = b & 0xffffffff;
+        std::uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+        std::uint64_t mid = (ll >> 32) + (hl & 0xffffffff) + (lh & 0xffffffff);
+        std::uint64_t lo = (mid << 32) | (ll & 0xffffffff);
+        std::uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+        return lo ^ hi;
+#endif
+    }
+
+      // Table for the byte-at-a-time CRC32C, built at compile time
+    struct Crc32cTable
+    {
+        std::uint32_t entries[256];
+        constexpr Crc32cTable() : entries()
+        {
+            for (std::uint32_t k = 0; k < 256; k++)
+            {
+                std::uint32_t c = k;
+                for (int bit = 0; bit < 8; bit++)
+                    c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                entries[k] = c;
+            }
+        }
+    };
+    constexpr Crc32cTable crc32cTable;
+}
+
+  // The 64-bit FNV-1a hash: one multiply per byte, tiny and branch free,
+  // but its cost grows with every character.
+struct Fnv1aHash
+{
+    std::size_t operator()(std::string_view id) const
+    {
+        std::uint64_t h = 0xcbf29ce484222325;
+        for (char c : id)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3;
+        }
+        return static_cast<std::size_t>(h);
+    }
+};
+
+  // Modeled on wyhash: a name of up to 16 bytes is read as at most four
+  // overlapping loads and mixed with two wide multiplies, which suits
+  // identifiers, nearly all of which are that short.
+struct WyHash
+{
+    std::size_t operator()(std::string_view id) const
+    {
+        using namespace hashdetail;
+        const std::uint64_t s0 = 0xa0761d6478bd642f, s1 = 0xe7037ed1a0b428db;
+        const char* p = id.data();
+        std::size_t len = id.size();
+        std::uint64_t seed = s0;
+        std::uint64_t a, b;
+        if (len <= 16)
+        {
+            if (len >= 4)
+            {
+                std::size_t mid = (len >> 3) << 2;  // 0 for 4-7 bytes, 4 for 8-16
+                a = (read4(p) << 32) | read4(p + mid);
+                b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+            }
+            else if (len > 0)
+            {
+                a = (static_cast<std::uint64_t>(static_cast<unsigned char>(p[0])) << 16) |
+                    (static_cast<std::uint64_t>(static_cast<unsigned char>(p[len >> 1])) << 8) |
+                    static_cast<unsigned char>(p[len - 1]);
+                b = 0;
+            }
+            else
+                a = b = 0;
+        }
+        else
+        {
+            std::size_t i = len;
+            for ( ; i > 16; i -= 16, p += 16)
+                seed = mum(read8(p) ^ s1, read8(p + 8) ^ seed);
+            a = read8(p + i - 16);
+            b = read8(p + i - 8);
+        }
+        return static_cast<std::size_t>(mum(s1 ^ len, mum(a ^ s1, b ^ seed)));
+    }
+};
+
+  // CRC32C of the name, 8 bytes per instruction with SSE4.2 (build with
+  // -msse4.2 or -march=native) and a table lookup per byte without it.
+  // A CRC is only 32 bits, which would leave just 25 above the tag to pick
+  // a slot, so it goes through one wide multiply at the end, along with
+  // the length, to spread it over all 64.
+struct Crc32cHash
+{
+    std::size_t operator()(std::string_view id) const
+    {
+        const char* p = id.data();
+        std::size_t len = id.size();
+        std::uint32_t crc = 0xffffffff;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+        std::uint64_t crc64 = crc;
+        for ( ; len >= 8; len -= 8, p += 8)
+            crc64 = _mm_crc32_u64(crc64, hashdetail::read8(p));
+        crc = static_cast<std::uint32_t>(crc64);
+        for ( ; len > 0; len--, p++)
+            crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*p));
+#else
+        for ( ; len > 0; len--, p++)
+            crc = hashdetail::crc32cTable.entries[(crc ^ static_cast<unsigned char>(*p)) & 0xff] ^ (crc >> 8);
+#endif
+        std::uint64_t h = (static_cast<std::uint64_t>(id.size()) << 32) | static_cast<std::uint32_t>(~crc);
+        return static_cast<std::size_t>(hashdetail::mum(h ^ 0xa0761d6478bd642f, 0xe7037ed1a0b428db));
+    }
+};
+
+#endif // HASHPOLICIES_INCLUDED
@@ -1,134 +1,65 @@
 #include "NameTable.h"
-#include <string>
-#include <list>
-#include <functional>
+#include "BasicNameTable.h"
+#include <string_view>
+#include <algorithm>
 using namespace std;
 
-const int BUCKETS = 19997;
-
-//*********** HashtableByDepth implementation and functions **************
-//*********** HashtableByDepth implementation and functions **************
-//*********** HashtableByDepth implementation and functions **************
-//*********** HashtableByDepth implementation and functions **************
-//*********** HashtableByDepth implementation and functions **************
-
-class HashTable
-{
-    private:
-        struct declaration{
-            string m_Name;
-            int m_Line;
-            int m_Depth;
-            declaration(string name, int line, int depth) : m_Name(name), m_Line(line), m_Depth(depth)
-            {}
-            declaration() : m_Name(""), m_Line(-1), m_Depth(-1)
-            {}
-
-        };
-        list<declaration> sortedByDepth[BUCKETS];
-        list<declaration> sortedRandomly[BUCKETS];
-public:
-    HashTable();
-    int find(const string& id, const int depth) const;//returns line number of this declaration
-    void insert(const string& id, const int depth, const int line);//pushes back into linked list the new declaration
-    void destroyScope(const int scope);//deletes all of the items of a scope from both hashtables
-};
-
-HashTable::HashTable()
-{}
-
-void HashTable::insert(const string& id, const int depth, const int line)
-{
-    sortedByDepth[depth].push_back(declaration(id, line, depth));
-    sortedRandomly[(hash<string>()(to_string(depth) + id) % (BUCKETS-1))].push_back(declaration(id, line, depth));
-}
-
-int HashTable::find(const string& id, const int depth) const
-{//loop through the proper bucket searching for the correct name of the declaration, then return the  line of that declaration
-    
-        auto& cell = sortedRandomly[(hash<string>()(to_string(depth) + id) % (BUCKETS-1))];
-        for(auto p = cell.begin(); p != cell.end(); p++){
-            if(p->m_Name == id){
-                return p->m_Line;
-            }
-        }
-    return -1;
-}
-
-void HashTable::destroyScope(const int scope)//deletes all of the items of a scope from both hashtables
-{
-    for(list<declaration>::iterator p = sortedByDepth[scope].begin();sortedByDepth[scope].size() != 0 && p != sortedByDepth[scope].end();)//loop through the sortedByDepth hash table's certain scope and save the name of a declaration then delete it
-    {
-        string id = p->m_Name;
-        p = sortedByDepth[scope].erase(p);
-        for(list<declaration>::iterator p = sortedRandomly[(hash<string>()(to_string(scope) + id) % (BUCKETS-1))].begin();sortedRandomly[(hash<string>()(to_string(scope) + id) % (BUCKETS-1))].size() != 0 &&  p != sortedRandomly[(hash<string>()(to_string(scope) + id) % (BUCKETS-1))].end(); p++){
-            if(p->m_Name == id){//find the declaration in sortedRandomly then delete it
-                sortedRandomly[(hash<string>()(to_string(scope) + id) % (BUCKETS-1))].erase(p);
-                break;
-            }
-        }
-    }
-}
-
 //*********** NameTableImpl implementation and functions **************
 //*********** NameTableImpl implementation and functions **************
 //*********** NameTableImpl implementation and functions **************
 //*********** NameTableImpl implementation and functions **************
 //*********** NameTableImpl implementation and functions **************
-// This class does the real work of the implementation.
+// This class does the real work of the implementation: it is the generic
+// table from BasicNameTable.h holding line numbers, plus the batch API.
 
-class NameTableImpl
+class NameTableImpl : public BasicNameTable<int>
 {
   public:
-    NameTableImpl();
-    void enterScope();
-    bool exitScope();//need to delete all of the variables declared in this scope
-    bool declare(const string& id, int lineNum);//needs to add the declaration to the hash table unless this declaration has already been made in this scope
-    int find(const string& id) const;
-    
-  private:
-    int scopeDepth;//line 1 starts at a scope of 0, then every new scope entered is one greater
-    //data structure to be used - 2 hash tables
-    HashTable hashy;
+    NameTableImpl(ExitPolicy policy);
+    void executeBatch(const CommandBatch& batch, int* results);
 };
 
-NameTableImpl::NameTableImpl():  scopeDepth(0)
+NameTableImpl::NameTableImpl(ExitPolicy policy):  BasicNameTable<int>(policy)
 {}
 
-void NameTableImpl::enterScope()
-{
-    scopeDepth++;
-}
-
-bool NameTableImpl::exitScope()
+class FrozenNameTableImpl : public BasicFrozenNameTable<int>
 {
-    if(scopeDepth>0){//if you can exit the scope
-        hashy.destroyScope(scopeDepth);
-        scopeDepth--;
-        return true;
-    }
-    return false;
-}
+  public:
+    FrozenNameTableImpl(const NameTableImpl& table) : BasicFrozenNameTable<int>(table) {}
+};
 
-bool NameTableImpl::declare(const string& id, int lineNum)
+static int lineOf(const int* line)
 {
-    if(id == "")
-        return false;
-    if(hashy.find(id, scopeDepth) != -1)
-        return false;
-    hashy.insert(id, scopeDepth, lineNum);
-    return true;
+    return line == nullptr ? -1 : *line;
 }
 
-int NameTableImpl::find(const string& id) const
-{//returns the line at which this declaration was made or -1 if it has not been made
-    int line = -1;
-    int tempDepth = scopeDepth;
-    while(line == -1 && tempDepth >= 0){
-        line = hashy.find(id, tempDepth);
-        tempDepth--;
+const size_t PREFETCH_DISTANCE = 8;//how many commands ahead executeBatch prefetches symbols
+
+void NameTableImpl::executeBatch(const CommandBatch& batch, int* results)
+{//one switch per command instead of a virtual call, and the symbols a few commands ahead are already on their way in
+    const unsigned char* ops = batch.ops.data();
+    const SymbolId* syms = batch.symbols.data();
+    const int* lines = batch.lines.data();
+    size_t n = batch.size();
+    for(size_t k = 0; k < n; k++){
+        if(k + PREFETCH_DISTANCE < n)
+            prefetch(syms[k + PREFETCH_DISTANCE]);//does nothing for the -1 of a scope command
+        switch(ops[k]){
+            case CommandBatch::ENTER_SCOPE:
+                enterScope();
+                results[k] = 1;
+                break;
+            case CommandBatch::EXIT_SCOPE:
+                results[k] = exitScope();
+                break;
+            case CommandBatch::DECLARE:
+                results[k] = declare(syms[k], lines[k]);
+                break;
+            case CommandBatch::FIND:
+                results[k] = lineOf(find(syms[k]));
+                break;
+        }
     }
-    return line;
 }
 
 //*********** NameTable functions **************
@@ -140,36 +71,159 @@ int NameTableImpl::find(const string& id) const
 //*********** NameTable functions **************
 
 // For the most part, these functions simply delegate to NameTableImpl's
-// functions.
+// functions.  The NameTableImpl is only allocated once the table is first
+// changed, so a NameTable that is built and thrown away costs one pointer.
 
-NameTable::NameTable()
-{
-    m_impl = new NameTableImpl;
-}
+NameTable::NameTable(ExitPolicy policy) : m_impl(nullptr), m_policy(policy)
+{}
 
 NameTable::~NameTable()
 {
     delete m_impl;
 }
 
+NameTableImpl* NameTable::impl()
+{
+    if (m_impl == nullptr)
+        m_impl = new NameTableImpl(m_policy);
+    return m_impl;
+}
+
 void NameTable::enterScope()
 {
-    m_impl->enterScope();
+    impl()->enterScope();
 }
 
 bool NameTable::exitScope()
 {
-    return m_impl->exitScope();
+    return m_impl != nullptr && m_impl->exitScope();
+}
+
+bool NameTable::declare(string_view id, int lineNum)
+{
+    return impl()->declare(id, lineNum);
+}
+
+int NameTable::find(string_view id) const
+{
+    return m_impl == nullptr ? -1 : lineOf(m_impl->find(id));
+}
+
+SymbolId NameTable::intern(string_view id)
+{
+    return impl()->intern(id);
+}
+
+bool NameTable::declare(SymbolId sym, int lineNum)
+{
+    return m_impl != nullptr && m_impl->declare(sym, lineNum);
 }
 
-bool NameTable::declare(const string& id, int lineNum)
+int NameTable::find(SymbolId sym) const
 {
-    return m_impl->declare(id, lineNum);
+    return m_impl == nullptr ? -1 : lineOf(m_impl->find(sym));
 }
 
-int NameTable::find(const string& id) const
+void NameTable::executeBatch(const CommandBatch& batch, int* results)
 {
-    return m_impl->find(id);
+    if (batch.size() != 0)
+        impl()->executeBatch(batch, results);
 }
 
+void NameTable::findMany(const std::string_view* ids, size_t count, int* outLines) const
+{
+    if (m_impl == nullptr)
+    {
+        for (size_t k = 0; k < count; k++)
+            outLines[k] = -1;
+        return;
+    }
+    const size_t CHUNK = 64;
+    const int* found[CHUNK];
+    for (size_t start = 0; start < count; start += CHUNK)
+    {
+        size_t n = min(CHUNK, count - start);
+        m_impl->findMany(ids + start, n, found);
+        for (size_t k = 0; k < n; k++)
+            outLines[start + k] = lineOf(found[k]);
+    }
+}
+
+NameTableStats NameTable::stats() const
+{
+    if (m_impl != nullptr)
+        return m_impl->stats();
+    NameTableStats st;
+    st.liveDeclarations.assign(1, 0);
+    return st;
+}
+
+void NameTable::begin()
+{
+    impl()->begin();
+}
+
+bool NameTable::commit()
+{
+    return m_impl != nullptr && m_impl->commit();
+}
+
+bool NameTable::rollback()
+{
+    return m_impl != nullptr && m_impl->rollback();
+}
+
+FrozenNameTable NameTable::freeze() const
+{
+    return FrozenNameTable(m_impl == nullptr ? nullptr : new FrozenNameTableImpl(*m_impl));
+}
+
+//*********** FrozenNameTable functions **************
+//*********** FrozenNameTable functions **************
+//*********** FrozenNameTable functions **************
+//*********** FrozenNameTable functions **************
+//*********** FrozenNameTable functions **************
+
+FrozenNameTable::FrozenNameTable(FrozenNameTableImpl* impl) : m_impl(impl)
+{}
 
+FrozenNameTable::~FrozenNameTable()
+{
+    delete m_impl;
+}
+
+FrozenNameTable::FrozenNameTable(FrozenNameTable&& other) noexcept : m_impl(other.m_impl)
+{
+    other.m_impl = nullptr;
+}
+
+FrozenNameTable& FrozenNameTable::operator=(FrozenNameTable&& other) noexcept
+{
+    if (this != &other)
+    {
+        delete m_impl;
+        m_impl = other.m_impl;
+        other.m_impl = nullptr;
+    }
+    return *this;
+}
+
+int FrozenNameTable::find(string_view id) const
+{
+    return m_impl == nullptr ? -1 : lineOf(m_impl->find(id));
+}
+
+int FrozenNameTable::find(SymbolId sym) const
+{
+    return m_impl == nullptr ? -1 : lineOf(m_impl->find(sym));
+}
+
+size_t FrozenNameTable::size() const
+{
+    return m_impl == nullptr ? 0 : m_impl->size();
+}
+
+size_t FrozenNameTable::bytesUsed() const
+{
+    return sizeof(FrozenNameTable) + (m_impl == nullptr ? 0 : m_impl->bytesUsed());
+}
@@ -1,25 +1,157 @@
 #ifndef NAMETABLE_INCLUDED
 #define NAMETABLE_INCLUDED
 
-#include <string>
+#include <string_view>
+#include <vector>
 
 class NameTableImpl;
+class FrozenNameTableImpl;
 
+  // Counting finds, lookups and probes for stats() costs a few stores on
+  // every find and makes find unsafe to call from several threads at once,
+  // so it is off unless the table is built with -DNAMETABLE_STATS=1.
+#ifndef NAMETABLE_STATS
+#define NAMETABLE_STATS 0
+#endif
+
+  // A SymbolId is a compact handle for one distinct identifier spelling.
+  // Front ends that already tokenize can intern each name once and then
+  // use the SymbolId overloads, which never hash or compare strings.
+  // -1 is never a valid SymbolId.
+typedef int SymbolId;
+
+  // EAGER_EXIT removes a scope's declarations as soon as the scope is
+  // exited.  LAZY_EXIT makes exitScope constant time instead: declarations
+  // from closed scopes are skipped by find and cleaned up later, which is
+  // cheaper when most of a scope's names are never looked up again.
+enum ExitPolicy {
+    EAGER_EXIT, LAZY_EXIT
+};
+
+  // A CommandBatch holds a run of commands as parallel arrays (one opcode,
+  // symbol and line number per command) so a front end can hand many of
+  // them to NameTable::executeBatch at once.  The symbol is only used by
+  // DECLARE and FIND, and the line number only by DECLARE.
+struct CommandBatch
+{
+    enum Op {
+        ENTER_SCOPE, EXIT_SCOPE, DECLARE, FIND
+    };
+    std::vector<unsigned char> ops;
+    std::vector<SymbolId> symbols;
+    std::vector<int> lines;
+
+    size_t size() const { return ops.size(); }
+    void clear() { ops.clear(); symbols.clear(); lines.clear(); }
+    void enterScope() { add(ENTER_SCOPE, -1, 0); }
+    void exitScope() { add(EXIT_SCOPE, -1, 0); }
+    void declare(SymbolId sym, int lineNum) { add(DECLARE, sym, lineNum); }
+    void find(SymbolId sym) { add(FIND, sym, 0); }
+  private:
+    void add(Op op, SymbolId sym, int lineNum)
+    {
+        ops.push_back(static_cast<unsigned char>(op));
+        symbols.push_back(sym);
+        lines.push_back(lineNum);
+    }
+};
+
+  // A snapshot of how a NameTable is laid out and how hard find has had to
+  // work, for tuning the table against real identifier sets.
+struct NameTableStats
+{
+    size_t symbols = 0;       // distinct names interned
+    size_t slots = 0;         // slots in the hash index
+    double loadFactor = 0;    // symbols / slots
+      // probeLengths[k] is how many symbols sit k slots past the slot their
+      // hash starts at, so a lookup that finds them probes k+1 slots
+    std::vector<size_t> probeLengths;
+      // liveDeclarations[d] is how many declarations scope d holds, with 0
+      // being the outermost scope
+    std::vector<size_t> liveDeclarations;
+    size_t staleDeclarations = 0;  // LAZY_EXIT: from closed scopes, not yet cleaned up
+    size_t bytesUsed = 0;          // heap memory the table holds
+      // Running totals since the table was first changed; always 0 unless
+      // built with NAMETABLE_STATS
+    unsigned long long finds = 0;         // by name or by symbol
+    unsigned long long lookups = 0;       // names looked up in the index by find
+    unsigned long long lookupProbes = 0;  // slots those lookups examined
+    unsigned long long chainSteps = 0;    // LAZY_EXIT: stale declarations find stepped past
+    unsigned long long filterRejects = 0; // finds the filter answered without probing the index
+};
+
+  // An immutable snapshot of the declarations a NameTable could see when
+  // it was frozen (see NameTable::freeze).  Nothing ever changes it, so
+  // any number of threads can call find on the same one at once without
+  // locking, while the NameTable it came from carries on.
+class FrozenNameTable
+{
+  public:
+    ~FrozenNameTable();
+    FrozenNameTable(FrozenNameTable&& other) noexcept;
+    FrozenNameTable& operator=(FrozenNameTable&& other) noexcept;
+    int find(std::string_view id) const;
+      // Symbols from the NameTable this was frozen from still work
+    int find(SymbolId sym) const;
+    size_t size() const;  // how many names are visible
+    size_t bytesUsed() const;
+      // We prevent a FrozenNameTable object from being copied or assigned
+    FrozenNameTable(const FrozenNameTable&) = delete;
+    FrozenNameTable& operator=(const FrozenNameTable&) = delete;
+
+  private:
+    friend class NameTable;
+    explicit FrozenNameTable(FrozenNameTableImpl* impl);
+    FrozenNameTableImpl* m_impl;  // nullptr for a snapshot of an empty table
+};
+
+  // A NameTable records a line number with each declaration.  For any
+  // other kind of value, use BasicNameTable<V> from BasicNameTable.h.
 class NameTable
 {
   public:
-    NameTable();
+    explicit NameTable(ExitPolicy policy = EAGER_EXIT);
     ~NameTable();
     void enterScope();
     bool exitScope();
-    bool declare(const std::string& id, int lineNum);
-    int find(const std::string& id) const;
+      // The names can be std::strings, string literals or slices of a
+      // source buffer alike, and find never allocates.
+    bool declare(std::string_view id, int lineNum);
+    int find(std::string_view id) const;
+    SymbolId intern(std::string_view id);
+    bool declare(SymbolId sym, int lineNum);
+    int find(SymbolId sym) const;
+      // Looks up count names at once, storing what find would return for
+      // ids[k] in outLines[k].  The lookups are interleaved so their cache
+      // misses overlap, which pays off when resolving dozens of names.
+    void findMany(const std::string_view* ids, size_t count, int* outLines) const;
+      // Runs every command in the batch in order.  results must have room
+      // for batch.size() ints: FIND stores the line number (or -1), DECLARE
+      // and EXIT_SCOPE store 1 for success and 0 for failure, and
+      // ENTER_SCOPE stores 1.
+    void executeBatch(const CommandBatch& batch, int* results);
+      // Walks the whole table, so this takes time proportional to its size
+    NameTableStats stats() const;
+      // begin starts a transaction, which can be nested inside another.
+      // rollback undoes every declare, enterScope and exitScope since the
+      // innermost open transaction began, in time proportional to how much
+      // there is to undo, and commit keeps them (though a rollback of an
+      // enclosing transaction still undoes them).  Both return false if no
+      // transaction is open.
+    void begin();
+    bool commit();
+    bool rollback();
+      // Copies the declarations that are visible now into a compact
+      // snapshot for lookups from other threads
+    FrozenNameTable freeze() const;
       // We prevent a NameTable object from being copied or assigned
     NameTable(const NameTable&) = delete;
     NameTable& operator=(const NameTable&) = delete;
 
   private:
+    NameTableImpl* impl();  // allocates the implementation on first use
     NameTableImpl* m_impl;
+    ExitPolicy m_policy;
 };
 
 #endif // NAMETABLE_INCLUDED
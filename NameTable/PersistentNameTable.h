@@ -0,0 +1,419 @@
+#ifndef PERSISTENTNAMETABLE_INCLUDED
+#define PERSISTENTNAMETABLE_INCLUDED
+
+#include "BasicNameTable.h"
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <utility>
+
+  // A BasicPersistentNameTable<V> answers the same questions as a
+  // BasicNameTable<V>, but every version of it is kept for as long as
+  // something refers to it.  checkpoint() names the current version and
+  // restore() goes back to one, both in constant time, so a parser can try
+  // one reading of the input, and if it doesn't work out, return to where
+  // it started without undoing every declaration by hand.
+  //
+  // The declarations live in a hash array mapped trie keyed by SymbolId.
+  // Declaring copies only the few nodes on the path to the symbol's leaf,
+  // and everything else is shared with older versions, which hold on to
+  // the nodes they use with reference counts.  A scope remembers the trie
+  // it started with, so exiting one is constant time too.  Checkpoints
+  // aren't safe to share between threads, and only mean something to the
+  // table they came from.  V must be copy constructible.
+
+template<typename V, typename Hash = NAMETABLE_HASH>
+class BasicPersistentNameTable
+{
+  private:
+    struct node;
+    struct frame;
+  public:
+      // A version of the table.  Copying one is as cheap as making it.
+    class Checkpoint
+    {
+      public:
+        Checkpoint() : m_Root(nullptr), m_Scopes(nullptr), m_Depth(0) {}
+        Checkpoint(const Checkpoint& other);
+        Checkpoint& operator=(const Checkpoint& other);
+        ~Checkpoint();
+      private:
+        friend class BasicPersistentNameTable;
+        node* m_Root;//the declarations visible in this version, or nullptr if none
+        frame* m_Scopes;//the innermost open scope, or nullptr at the outermost scope
+        int m_Depth;
+    };
+
+    BasicPersistentNameTable();
+    void enterScope();
+    bool exitScope();
+    SymbolId intern(std::string_view id);
+    bool declare(std::string_view id, V value);
+    bool declare(SymbolId sym, V value);
+      // A pointer from find stays good for as long as any version that can
+      // see the declaration is kept
+    const V* find(std::string_view id) const;
+    const V* find(SymbolId sym) const;
+    Checkpoint checkpoint() const;
+    void restore(const Checkpoint& cp);
+      // We prevent a BasicPersistentNameTable object from being copied or
+      // assigned; take a checkpoint instead
+    BasicPersistentNameTable(const BasicPersistentNameTable&) = delete;
+    BasicPersistentNameTable& operator=(const BasicPersistentNameTable&) = delete;
+
+  private:
+    static constexpr unsigned BITS = 5;//each level of the trie uses this many bits of the SymbolId
+    struct leaf{//one declaration; shared by every version that can see it
+        unsigned m_Refs;
+        SymbolId m_Sym;
+        int m_Depth;
+        V m_Value;
+    };
+    union child{
+        node* m_Node;
+        leaf* m_Leaf;
+    };
+    struct alignas(child) node{//followed in memory by one child for every bit set in m_Bitmap
+        unsigned m_Refs;
+        std::uint32_t m_Bitmap;//which of the 32 branches are present
+        std::uint32_t m_Leaves;//which of those hold a leaf instead of a node
+        child* children() { return reinterpret_cast<child*>(this + 1); }
+        const child* children() const { return reinterpret_cast<const child*>(this + 1); }
+    };
+    struct frame{//an open scope: the trie to go back to when it exits
+        unsigned m_Refs;
+        node* m_SavedRoot;
+        frame* m_Outer;
+    };
+    static unsigned branchOf(SymbolId sym, unsigned shift);
+    static unsigned countOf(std::uint32_t bits);
+    static unsigned indexOf(std::uint32_t bitmap, std::uint32_t bit);
+    static node* newNode(unsigned count);
+    static void freeNode(node* n);
+    static void retain(node* n);
+    static void release(node* n);
+    static void release(leaf* l);
+    static void release(frame* f);
+    static node* unshare(node* n);
+    static node* with(node* n, unsigned shift, SymbolId sym, leaf* l);
+    static const leaf* lookup(const node* n, SymbolId sym);
+    nametabledetail::HashTable<char, Hash> spellings;//only used to intern names
+    Checkpoint current;
+};
+
+//*********** BasicPersistentNameTable::Checkpoint functions **************
+//*********** BasicPersistentNameTable::Checkpoint functions **************
+//*********** BasicPersistentNameTable::Checkpoint functions **************
+//*********** BasicPersistentNameTable::Checkpoint functions **************
+//*********** BasicPersistentNameTable::Checkpoint functions **************
+
+template<typename V, typename Hash>
+BasicPersistentNameTable<V, Hash>::Checkpoint::Checkpoint(const Checkpoint& other)
+    : m_Root(other.m_Root), m_Scopes(other.m_Scopes), m_Depth(other.m_Depth)
+{
+    retain(m_Root);
+    if(m_Scopes != nullptr)
+        m_Scopes->m_Refs++;
+}
+
+template<typename V, typename Hash>
+typename BasicPersistentNameTable<V, Hash>::Checkpoint&
+BasicPersistentNameTable<V, Hash>::Checkpoint::operator=(const Checkpoint& other)
+{//take the new references before dropping the old ones, in case they are the same
+    retain(other.m_Root);
+    if(other.m_Scopes != nullptr)
+        other.m_Scopes->m_Refs++;
+    release(m_Root);
+    release(m_Scopes);
+    m_Root = other.m_Root;
+    m_Scopes = other.m_Scopes;
+    m_Depth = other.m_Depth;
+    return *this;
+}
+
+template<typename V, typename Hash>
+BasicPersistentNameTable<V, Hash>::Checkpoint::~Checkpoint()
+{
+    release(m_Root);
+    release(m_Scopes);
+}
+
+//*********** BasicPersistentNameTable trie functions **************
+//*********** BasicPersistentNameTable trie functions **************
+//*********** BasicPersistentNameTable trie functions **************
+//*********** BasicPersistentNameTable trie functions **************
+//*********** BasicPersistentNameTable trie functions **************
+
+template<typename V, typename Hash>
+unsigned BasicPersistentNameTable<V, Hash>::branchOf(SymbolId sym, unsigned shift)
+{
+    return (static_cast<unsigned>(sym) >> shift) & 31;
+}
+
+template<typename V, typename Hash>
+unsigned BasicPersistentNameTable<V, Hash>::countOf(std::uint32_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(bits);
+#else
+    unsigned count = 0;
+    for( ; bits != 0; bits &= bits - 1)
+        count++;
+    return count;
+#endif
+}
+
+template<typename V, typename Hash>
+unsigned BasicPersistentNameTable<V, Hash>::indexOf(std::uint32_t bitmap, std::uint32_t bit)
+{//a branch's child comes after the children of every lower branch that is present
+    return countOf(bitmap & (bit - 1));
+}
+
+template<typename V, typename Hash>
+typename BasicPersistentNameTable<V, Hash>::node* BasicPersistentNameTable<V, Hash>::newNode(unsigned count)
+{
+    node* n = static_cast<node*>(::operator new(sizeof(node) + count * sizeof(child)));
+    n->m_Refs = 1;
+    n->m_Bitmap = 0;
+    n->m_Leaves = 0;
+    return n;
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::freeNode(node* n)
+{//only the memory; whoever calls this has already dealt with the children
+    ::operator delete(n);
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::retain(node* n)
+{
+    if(n != nullptr)
+        n->m_Refs++;
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::release(node* n)
+{//recursion is no deeper than the trie, which is at most 7 levels
+    if(n == nullptr || --n->m_Refs != 0)
+        return;
+    unsigned count = countOf(n->m_Bitmap);
+    for(unsigned b = 0, k = 0; k < count; b++){
+        std::uint32_t bit = std::uint32_t(1) << b;
+        if(!(n->m_Bitmap & bit))
+            continue;
+        if(n->m_Leaves & bit)
+            release(n->children()[k].m_Leaf);
+        else
+            release(n->children()[k].m_Node);
+        k++;
+    }
+    freeNode(n);
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::release(leaf* l)
+{
+    if(--l->m_Refs == 0)
+        delete l;
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::release(frame* f)
+{//a loop rather than recursion, since scopes can nest as deep as memory allows
+    while(f != nullptr && --f->m_Refs == 0){
+        frame* outer = f->m_Outer;
+        release(f->m_SavedRoot);
+        delete f;
+        f = outer;
+    }
+}
+
+template<typename V, typename Hash>
+typename BasicPersistentNameTable<V, Hash>::node* BasicPersistentNameTable<V, Hash>::unshare(node* n)
+{//takes over one reference to n and returns a node with the same children that nobody else refers to
+    if(n->m_Refs == 1)
+        return n;
+    unsigned count = countOf(n->m_Bitmap);
+    node* copy = newNode(count);
+    copy->m_Bitmap = n->m_Bitmap;
+    copy->m_Leaves = n->m_Leaves;
+    for(unsigned b = 0, k = 0; k < count; b++){
+        std::uint32_t bit = std::uint32_t(1) << b;
+        if(!(n->m_Bitmap & bit))
+            continue;
+        copy->children()[k] = n->children()[k];
+        if(n->m_Leaves & bit)
+            copy->children()[k].m_Leaf->m_Refs++;
+        else
+            copy->children()[k].m_Node->m_Refs++;
+        k++;
+    }
+    n->m_Refs--;
+    return copy;
+}
+
+template<typename V, typename Hash>
+typename BasicPersistentNameTable<V, Hash>::node*
+BasicPersistentNameTable<V, Hash>::with(node* n, unsigned shift, SymbolId sym, leaf* l)
+{//takes over one reference to n (which may be nullptr) and to l, and returns the trie with l as sym's leaf.
+ //Nodes nobody else refers to are changed in place; shared ones are copied, which is the path copying.
+    std::uint32_t bit = std::uint32_t(1) << branchOf(sym, shift);
+    if(n == nullptr){
+        n = newNode(1);
+        n->m_Bitmap = n->m_Leaves = bit;
+        n->children()[0].m_Leaf = l;
+        return n;
+    }
+    unsigned k = indexOf(n->m_Bitmap, bit);
+    if(n->m_Bitmap & bit){
+        n = unshare(n);
+        child& c = n->children()[k];
+        if(!(n->m_Leaves & bit))
+            c.m_Node = with(c.m_Node, shift + BITS, sym, l);
+        else if(c.m_Leaf->m_Sym == sym){
+            release(c.m_Leaf);
+            c.m_Leaf = l;
+        }
+        else{//two symbols share this branch, so it becomes a node one level down holding both
+            leaf* other = c.m_Leaf;
+            c.m_Node = with(with(nullptr, shift + BITS, other->m_Sym, other), shift + BITS, sym, l);
+            n->m_Leaves &= ~bit;
+        }
+        return n;
+    }
+    unsigned count = countOf(n->m_Bitmap);
+    node* grown = newNode(count + 1);
+    grown->m_Bitmap = n->m_Bitmap | bit;
+    grown->m_Leaves = n->m_Leaves | bit;
+    for(unsigned j = 0; j < k; j++)
+        grown->children()[j] = n->children()[j];
+    grown->children()[k].m_Leaf = l;
+    for(unsigned j = k; j < count; j++)
+        grown->children()[j + 1] = n->children()[j];
+    if(n->m_Refs == 1)
+        freeNode(n);//its children now belong to grown
+    else{
+        for(unsigned b = 0, j = 0; j < count; b++){
+            std::uint32_t other = std::uint32_t(1) << b;
+            if(!(n->m_Bitmap & other))
+                continue;
+            if(n->m_Leaves & other)
+                n->children()[j].m_Leaf->m_Refs++;
+            else
+                n->children()[j].m_Node->m_Refs++;
+            j++;
+        }
+        n->m_Refs--;
+    }
+    return grown;
+}
+
+template<typename V, typename Hash>
+const typename BasicPersistentNameTable<V, Hash>::leaf*
+BasicPersistentNameTable<V, Hash>::lookup(const node* n, SymbolId sym)
+{
+    for(unsigned shift = 0; n != nullptr; shift += BITS){
+        std::uint32_t bit = std::uint32_t(1) << branchOf(sym, shift);
+        if(!(n->m_Bitmap & bit))
+            return nullptr;
+        const child& c = n->children()[indexOf(n->m_Bitmap, bit)];
+        if(n->m_Leaves & bit)
+            return c.m_Leaf->m_Sym == sym ? c.m_Leaf : nullptr;
+        n = c.m_Node;
+    }
+    return nullptr;
+}
+
+//*********** BasicPersistentNameTable implementation and functions **************
+//*********** BasicPersistentNameTable implementation and functions **************
+//*********** BasicPersistentNameTable implementation and functions **************
+//*********** BasicPersistentNameTable implementation and functions **************
+//*********** BasicPersistentNameTable implementation and functions **************
+
+template<typename V, typename Hash>
+BasicPersistentNameTable<V, Hash>::BasicPersistentNameTable() : spellings(false)
+{}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::enterScope()
+{
+    frame* f = new frame{ 1, current.m_Root, current.m_Scopes };//takes over current's references
+    current.m_Root = f->m_SavedRoot;
+    retain(current.m_Root);
+    current.m_Scopes = f;
+    current.m_Depth++;
+}
+
+template<typename V, typename Hash>
+bool BasicPersistentNameTable<V, Hash>::exitScope()
+{
+    if(current.m_Depth == 0)
+        return false;
+    frame* f = current.m_Scopes;
+    release(current.m_Root);
+    current.m_Root = f->m_SavedRoot;
+    retain(current.m_Root);
+    current.m_Scopes = f->m_Outer;
+    if(current.m_Scopes != nullptr)
+        current.m_Scopes->m_Refs++;
+    release(f);
+    current.m_Depth--;
+    return true;
+}
+
+template<typename V, typename Hash>
+SymbolId BasicPersistentNameTable<V, Hash>::intern(std::string_view id)
+{//the empty string can never be declared, so it never gets a symbol
+    if(id.empty())
+        return -1;
+    return spellings.intern(id);
+}
+
+template<typename V, typename Hash>
+bool BasicPersistentNameTable<V, Hash>::declare(std::string_view id, V value)
+{
+    return declare(intern(id), std::move(value));
+}
+
+template<typename V, typename Hash>
+bool BasicPersistentNameTable<V, Hash>::declare(SymbolId sym, V value)
+{
+    if(sym < 0 || sym >= static_cast<SymbolId>(spellings.symbolCount()))
+        return false;
+    const leaf* old = lookup(current.m_Root, sym);
+    if(old != nullptr && old->m_Depth == current.m_Depth)
+        return false;//already declared in this scope
+    leaf* l = new leaf{ 1, sym, current.m_Depth, std::move(value) };
+    current.m_Root = with(current.m_Root, 0, sym, l);
+    return true;
+}
+
+template<typename V, typename Hash>
+const V* BasicPersistentNameTable<V, Hash>::find(std::string_view id) const
+{
+    return find(spellings.lookup(id));
+}
+
+template<typename V, typename Hash>
+const V* BasicPersistentNameTable<V, Hash>::find(SymbolId sym) const
+{
+    if(sym < 0)
+        return nullptr;
+    const leaf* l = lookup(current.m_Root, sym);
+    return l == nullptr ? nullptr : &l->m_Value;
+}
+
+template<typename V, typename Hash>
+typename BasicPersistentNameTable<V, Hash>::Checkpoint BasicPersistentNameTable<V, Hash>::checkpoint() const
+{
+    return current;
+}
+
+template<typename V, typename Hash>
+void BasicPersistentNameTable<V, Hash>::restore(const Checkpoint& cp)
+{
+    current = cp;
+}
+
+#endif // PERSISTENTNAMETABLE_INCLUDED
@@ -0,0 +1,252 @@
+#ifndef WORKLOAD_INCLUDED
+#define WORKLOAD_INCLUDED
+
+// Synthetic NameTable workloads, shared by gencommands, which writes them
+// to files, and the tester, which checks the table against small ones.
+// Commands are streamed out as they are generated, and the generator only
+// remembers the declarations that are currently live, so a workload can
+// be far bigger than memory.
+
+#include "CommandFile.h"
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+  // What to generate; gencommands.cpp describes each of these
+struct WorkloadOptions
+{
+    unsigned long long count = 1000000;
+    double scopes = 0.1;
+    double declares = 0.2;
+    int maxDepth = 64;      // at least 1
+    double meanDepth = 8;
+    size_t vocab = 10000;
+    size_t misses = 0;      // 0 means vocab/4
+    double meanLength = 8;
+    double lengthStddev = 3;
+    int maxLength = 32;
+    double shadow = 0.1;
+    double hit = 0.5;
+    double zipf = 1.0;
+    unsigned long long seed = 1;
+
+    bool valid() const
+    {
+        return vocab > 0  &&  maxDepth >= 1  &&  maxLength > 0  &&  scopes + declares <= 1;
+    }
+};
+
+  // What writeWorkload wrote
+struct WorkloadSummary
+{
+    unsigned long long finds = 0;
+    unsigned long long hits = 0;   // finds for a visible name
+    size_t identifiers = 0;
+};
+
+namespace workloaddetail
+{
+      // Picks 0 to n-1, where k is chosen with probability proportional to
+      // 1/(k+1)^s, by binary search on the cumulative distribution.
+    class ZipfPicker
+    {
+      public:
+        ZipfPicker(size_t n, double s)
+         : m_cdf(n)
+        {
+            double sum = 0;
+            for (size_t k = 0; k < n; k++)
+            {
+                sum += 1 / std::pow(static_cast<double>(k + 1), s);
+                m_cdf[k] = sum;
+            }
+            for (size_t k = 0; k < n; k++)
+                m_cdf[k] /= sum;
+        }
+        size_t pick(std::mt19937_64& rng) const
+        {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            size_t k = std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin();
+            return std::min(k, m_cdf.size() - 1);
+        }
+      private:
+        std::vector<double> m_cdf;
+    };
+
+      // Makes count distinct identifiers whose lengths follow a normal
+      // distribution clamped to 1..maxLength.  If random spellings keep
+      // colliding (because short names run out), a number is appended.
+    inline void makeIdentifiers(size_t count, const WorkloadOptions& opt, std::mt19937_64& rng,
+                                std::unordered_set<std::string>& used, std::vector<std::string>& ids)
+    {
+        static const char first[] =
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+        static const char rest[] =
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+        std::normal_distribution<double> lengths(opt.meanLength, opt.lengthStddev);
+        for (size_t k = 0; k < count; k++)
+        {
+            std::string id;
+            for (int attempt = 0; ; attempt++)
+            {
+                int len = static_cast<int>(std::lround(lengths(rng)));
+                len = std::max(1, std::min(opt.maxLength, len));
+                id.assign(1, first[rng() % (sizeof(first) - 1)]);
+                for (int j = 1; j < len; j++)
+                    id += rest[rng() % (sizeof(rest) - 1)];
+                if (attempt >= 8)
+                    id += std::to_string(used.size());
+                if (used.insert(id).second)
+                    break;
+            }
+            ids.push_back(id);
+        }
+    }
+
+      // Where the commands go: a binary trace or text
+    class Output
+    {
+      public:
+        Output(std::ostream& out, const std::vector<std::string>& strings, bool text)
+         : m_out(out), m_strings(strings), m_writer(nullptr)
+        {
+            if (!text)
+            {
+                std::vector<std::string_view> views(strings.begin(), strings.end());
+                m_writer = new TraceWriter(out, views);
+            }
+        }
+        ~Output() { delete m_writer; }
+        void enterScope()
+        {
+            if (m_writer != nullptr) m_writer->enterScope(); else m_out << "{\n";
+        }
+        void exitScope()
+        {
+            if (m_writer != nullptr) m_writer->exitScope(); else m_out << "}\n";
+        }
+        void declare(size_t index, int lineNum)
+        {
+            if (m_writer != nullptr)
+                m_writer->declare(static_cast<int>(index), lineNum);
+            else
+                m_out << m_strings[index] << ' ' << lineNum << '\n';
+        }
+        void find(size_t index)
+        {
+            if (m_writer != nullptr)
+                m_writer->find(static_cast<int>(index));
+            else
+                m_out << m_strings[index] << '\n';
+        }
+        bool finish()
+        {
+            if (m_writer != nullptr)
+                return m_writer->finish();
+            m_out.flush();
+            return static_cast<bool>(m_out);
+        }
+          // We prevent an Output object from being copied or assigned
+        Output(const Output&) = delete;
+        Output& operator=(const Output&) = delete;
+      private:
+        std::ostream& m_out;
+        const std::vector<std::string>& m_strings;
+        TraceWriter* m_writer;
+    };
+}
+
+  // Writes the workload opt describes to out, as text or a binary trace.
+  // Every exitScope it writes matches an enterScope, so a correct table
+  // and the tester's slow one agree on every command.  Returns false if
+  // opt isn't valid or anything failed to be written.
+inline bool writeWorkload(const WorkloadOptions& options, std::ostream& out, bool text,
+                          WorkloadSummary& summary)
+{
+    using namespace workloaddetail;
+    if (!options.valid())
+        return false;
+    WorkloadOptions opt = options;
+    if (opt.misses == 0)
+        opt.misses = std::max<size_t>(1, opt.vocab / 4);
+
+    std::mt19937_64 rng(opt.seed);
+
+      // Identifiers 0 to vocab-1 get declared; the rest are only ever
+      // looked up, so finds for them always miss.
+
+    std::unordered_set<std::string> used;
+    std::vector<std::string> strings;
+    makeIdentifiers(opt.vocab + opt.misses, opt, rng, used, strings);
+    used.clear();
+    ZipfPicker declared(opt.vocab, opt.zipf);
+    ZipfPicker missed(opt.misses, opt.zipf);
+    Output output(out, strings, text);
+
+      // The generator's picture of the table: every live declaration, in
+      // order, and where each open scope's declarations start.
+
+    std::vector<size_t> live;
+    std::vector<size_t> scopeStarts;
+    std::uniform_real_distribution<double> unit(0, 1);
+    summary = WorkloadSummary();
+    summary.identifiers = strings.size();
+
+    for (unsigned long long n = 1; n <= opt.count; n++)
+    {
+        double r = unit(rng);
+        int depth = static_cast<int>(scopeStarts.size());
+        if (r < opt.scopes)
+        {
+              // Drift back toward the mean depth, never going past the
+              // outermost or the deepest allowed scope
+
+            double enterChance = 0.5 + (opt.meanDepth - depth) / (2 * (opt.meanDepth + 1));
+            enterChance = std::max(0.05, std::min(0.95, enterChance));
+            bool enter = (depth == 0  ||  unit(rng) < enterChance);
+            if (depth >= opt.maxDepth)
+                enter = false;
+            if (enter)
+            {
+                scopeStarts.push_back(live.size());
+                output.enterScope();
+            }
+            else
+            {
+                live.resize(scopeStarts.back());
+                scopeStarts.pop_back();
+                output.exitScope();
+            }
+        }
+        else if (r < opt.scopes + opt.declares)
+        {
+            size_t outerEnd = scopeStarts.empty() ? 0 : scopeStarts.back();
+            size_t index;
+            if (outerEnd > 0  &&  unit(rng) < opt.shadow)
+                index = live[rng() % outerEnd];  // shadow something from an enclosing scope
+            else
+                index = declared.pick(rng);
+            live.push_back(index);
+            output.declare(index, static_cast<int>(n % 2147483647));
+        }
+        else
+        {
+            summary.finds++;
+            if (!live.empty()  &&  unit(rng) < opt.hit)
+            {
+                summary.hits++;
+                output.find(live[rng() % live.size()]);
+            }
+            else
+                output.find(opt.vocab + missed.pick(rng));
+        }
+    }
+    return output.finish();
+}
+
+#endif // WORKLOAD_INCLUDED
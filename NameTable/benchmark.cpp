@@ -0,0 +1,343 @@
+// NameTable microbenchmarks
+//
+// Usage: benchmark [-ops n] [-json file]
+//
+// n, the number of operations timed for each benchmark, must be at least
+// GROUP, and is rounded down to a multiple of it.
+//
+// Times declare, find (hits and misses, with the scope being searched
+// from shallow or deeply nested), enterScope and exitScope separately, in
+// both exit modes.  For each it reports throughput and the p50, p99 and
+// p99.9 latency, and with -json also writes every result, including a
+// latency histogram, as JSON so runs of different builds can be compared.
+//
+// Each latency sample times a single operation, so one slow operation
+// shows up as one slow sample instead of being averaged with its
+// neighbors.  A single operation takes only a few nanoseconds, which is
+// about what reading the clock costs, so the median cost of a pair of
+// back-to-back clock reads is measured at startup and subtracted from
+// every sample.  Throughput is measured separately, over the whole run
+// without any clock reads.
+
+#include "NameTable.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+const int GROUP = 8;              // operations between calls to between
+const int DEEP = 256;            // nesting depth for the "deep" cases
+const int NAMES = 4096;          // distinct names declared or looked up
+const int LOCALS = 100;          // declarations in each scope exitScope closes
+
+volatile long long sink;         // keeps results from being optimized away
+
+struct Result
+{
+    string name;
+    string policy;
+    long long ops;
+    double mopsPerSec;
+    double p50;
+    double p99;
+    double p999;
+    vector<long long> histogram;  // histogram[0] counts samples under 2 ns, and
+                                  // histogram[k] those in [2^k, 2^(k+1)) ns
+};
+
+  // An operation to benchmark.  setup builds the table the operation runs
+  // against (untimed), op(k) performs the kth operation, and between(g) is
+  // called untimed after every GROUP operations, for example to refill a
+  // scope.
+
+struct Benchmark
+{
+    string name;
+    function<void(NameTable&)> setup;
+    function<void(NameTable&, long long)> op;
+    function<void(NameTable&, long long)> between;
+};
+
+double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t k = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[k];
+}
+
+typedef chrono::steady_clock Clock;
+
+  // The median time between two back-to-back clock reads, which is what
+  // timing an operation adds to it
+
+double clockOverhead()
+{
+    vector<double> samples(100001);
+    for (size_t k = 0; k < samples.size(); k++)
+    {
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = Clock::now();
+        samples[k] = chrono::duration<double, nano>(end - start).count();
+    }
+    sort(samples.begin(), samples.end());
+    return percentile(samples, 0.50);
+}
+
+Result run(const Benchmark& b, ExitPolicy policy, long long ops, double overhead)
+{
+    long long groups = ops / GROUP;
+    ops = groups * GROUP;
+
+    Result r;
+    r.name = b.name;
+    r.policy = (policy == EAGER_EXIT ? "eager" : "lazy");
+    r.ops = ops;
+
+      // Throughput: no clock reads inside the loop
+
+    double total;
+    {
+        NameTable nt(policy);
+        b.setup(nt);
+        double untimed = 0;
+        Clock::time_point start = Clock::now();
+        for (long long g = 0; g < groups; g++)
+        {
+            for (int k = 0; k < GROUP; k++)
+                b.op(nt, g * GROUP + k);
+            if (b.between)
+            {
+                Clock::time_point pause = Clock::now();
+                b.between(nt, g);
+                untimed += chrono::duration<double, nano>(Clock::now() - pause).count();
+            }
+        }
+        total = chrono::duration<double, nano>(Clock::now() - start).count() - untimed;
+    }
+    r.mopsPerSec = (total > 0 ? ops / total * 1000 : 0);
+
+      // Latency: one sample per operation, less the cost of the clock reads
+
+    vector<double> samples;
+    samples.reserve(ops);
+    {
+        NameTable nt(policy);
+        b.setup(nt);
+        for (long long g = 0; g < groups; g++)
+        {
+            for (int k = 0; k < GROUP; k++)
+            {
+                Clock::time_point start = Clock::now();
+                b.op(nt, g * GROUP + k);
+                Clock::time_point end = Clock::now();
+                samples.push_back(max(0.0, chrono::duration<double, nano>(end - start).count() - overhead));
+            }
+            if (b.between)
+                b.between(nt, g);
+        }
+    }
+    for (size_t k = 0; k < samples.size(); k++)
+    {
+        size_t bucket = 0;
+        for (double ns = samples[k]; ns >= 2; ns /= 2)
+            bucket++;
+        if (r.histogram.size() <= bucket)
+            r.histogram.resize(bucket + 1);
+        r.histogram[bucket]++;
+    }
+    sort(samples.begin(), samples.end());
+    r.p50 = percentile(samples, 0.50);
+    r.p99 = percentile(samples, 0.99);
+    r.p999 = percentile(samples, 0.999);
+    return r;
+}
+
+vector<string> makeNames(const string& prefix, int count)
+{
+    vector<string> names;
+    for (int k = 0; k < count; k++)
+        names.push_back(prefix + to_string(k));
+    return names;
+}
+
+vector<Benchmark> makeBenchmarks()
+{
+    static const vector<string> names = makeNames("name", NAMES);
+    static const vector<string> missing = makeNames("missing", NAMES);
+
+    auto declareAll = [](NameTable& nt) {
+        for (int k = 0; k < NAMES; k++)
+            nt.declare(names[k], k + 1);
+    };
+    auto nest = [](NameTable& nt, int depth) {
+        for (int d = 0; d < depth; d++)
+            nt.enterScope();
+    };
+    auto internMissing = [](NameTable& nt) {
+        for (int k = 0; k < NAMES; k++)
+            nt.intern(missing[k]);
+    };
+
+    vector<Benchmark> bs;
+
+      // Every group declares GROUP new names; a scope is swapped for a fresh
+      // one (untimed) before it could run out of names
+
+    bs.push_back({ "declare",
+        [=](NameTable& nt) { nt.enterScope(); },
+        [](NameTable& nt, long long k) { sink = nt.declare(names[k % NAMES], 1); },
+        [](NameTable& nt, long long g) {
+            if ((g + 1) * GROUP % NAMES == 0)
+            {
+                nt.exitScope();
+                nt.enterScope();
+            }
+        } });
+
+    bs.push_back({ "find_hit_shallow",
+        [=](NameTable& nt) { declareAll(nt); nest(nt, 1); },
+        [](NameTable& nt, long long k) { sink = nt.find(names[k * 7919 % NAMES]); },
+        nullptr });
+
+    bs.push_back({ "find_hit_deep",
+        [=](NameTable& nt) { declareAll(nt); nest(nt, DEEP); },
+        [](NameTable& nt, long long k) { sink = nt.find(names[k * 7919 % NAMES]); },
+        nullptr });
+
+      // Misses for names the table has seen before (interned) and never
+      // seen at all
+
+    bs.push_back({ "find_miss_shallow",
+        [=](NameTable& nt) { declareAll(nt); internMissing(nt); nest(nt, 1); },
+        [](NameTable& nt, long long k) { sink = nt.find(missing[k * 7919 % NAMES]); },
+        nullptr });
+
+    bs.push_back({ "find_miss_deep",
+        [=](NameTable& nt) { declareAll(nt); internMissing(nt); nest(nt, DEEP); },
+        [](NameTable& nt, long long k) { sink = nt.find(missing[k * 7919 % NAMES]); },
+        nullptr });
+
+    bs.push_back({ "find_miss_unseen",
+        [=](NameTable& nt) { declareAll(nt); nest(nt, DEEP); },
+        [](NameTable& nt, long long k) { sink = nt.find(missing[k * 7919 % NAMES]); },
+        nullptr });
+
+      // Scopes are entered GROUP at a time and unwound (untimed) afterwards,
+      // and vice versa, so the depth stays bounded
+
+    bs.push_back({ "enter_scope",
+        [=](NameTable& nt) { declareAll(nt); },
+        [](NameTable& nt, long long) { nt.enterScope(); },
+        [](NameTable& nt, long long) {
+            for (int k = 0; k < GROUP; k++)
+                nt.exitScope();
+        } });
+
+    bs.push_back({ "exit_scope_empty",
+        [=](NameTable& nt) { declareAll(nt); nest(nt, GROUP); },
+        [](NameTable& nt, long long) { sink = nt.exitScope(); },
+        [=](NameTable& nt, long long) { nest(nt, GROUP); } });
+
+    bs.push_back({ "exit_scope_100_locals",
+        [=](NameTable& nt) {
+            declareAll(nt);
+            for (int d = 0; d < GROUP; d++)
+            {
+                nt.enterScope();
+                for (int k = 0; k < LOCALS; k++)
+                    nt.declare(names[(d * LOCALS + k) % NAMES], k);
+            }
+        },
+        [](NameTable& nt, long long) { sink = nt.exitScope(); },
+        [=](NameTable& nt, long long) {
+            for (int d = 0; d < GROUP; d++)
+            {
+                nt.enterScope();
+                for (int k = 0; k < LOCALS; k++)
+                    nt.declare(names[(d * LOCALS + k) % NAMES], k);
+            }
+        } });
+
+    return bs;
+}
+
+void writeJson(ostream& out, const vector<Result>& results, double overhead)
+{
+    out << "{\n  \"clock_overhead_ns\": " << overhead << ",\n  \"results\": [\n";
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        const Result& r = results[k];
+        out << "    { \"name\": \"" << r.name << "\", \"policy\": \"" << r.policy
+            << "\", \"ops\": " << r.ops
+            << ", \"mops_per_sec\": " << r.mopsPerSec
+            << ", \"p50_ns\": " << r.p50
+            << ", \"p99_ns\": " << r.p99
+            << ", \"p999_ns\": " << r.p999
+            << ", \"histogram_log2_ns\": [";
+        for (size_t j = 0; j < r.histogram.size(); j++)
+            out << (j == 0 ? "" : ", ") << r.histogram[j];
+        out << "] }" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    long long ops = 1000000;
+    const char* jsonPath = nullptr;
+    bool usage = false;
+    for (int k = 1; k < argc; k++)
+    {
+        if (strcmp(argv[k], "-ops") == 0  &&  k + 1 < argc)
+            ops = atoll(argv[++k]);
+        else if (strcmp(argv[k], "-json") == 0  &&  k + 1 < argc)
+            jsonPath = argv[++k];
+        else
+            usage = true;
+    }
+    if (usage  ||  ops < GROUP)  // fewer than one group would measure nothing
+    {
+        cerr << "Usage: " << argv[0] << " [-ops n] [-json file]   (n at least " << GROUP << ")" << endl;
+        return 2;
+    }
+
+    vector<Result> results;
+    vector<Benchmark> bs = makeBenchmarks();
+    double overhead = clockOverhead();
+    cout << "Latencies are per operation, less " << fixed << setprecision(1) << overhead
+         << " ns for reading the clock." << endl;
+    cout << left << setw(24) << "benchmark" << setw(8) << "policy" << right
+         << setw(10) << "Mops/s" << setw(10) << "p50 ns" << setw(10) << "p99 ns"
+         << setw(10) << "p99.9 ns" << endl;
+    for (ExitPolicy policy : { EAGER_EXIT, LAZY_EXIT })
+    {
+        for (size_t k = 0; k < bs.size(); k++)
+        {
+            Result r = run(bs[k], policy, ops, overhead);
+            results.push_back(r);
+            cout << left << setw(24) << r.name << setw(8) << r.policy << right << fixed
+                 << setprecision(1) << setw(10) << r.mopsPerSec << setw(10) << r.p50
+                 << setw(10) << r.p99 << setw(10) << r.p999 << endl;
+        }
+    }
+
+    if (jsonPath != nullptr)
+    {
+        ofstream out(jsonPath);
+        if ( ! out)
+        {
+            cerr << "Cannot create " << jsonPath << endl;
+            return 1;
+        }
+        writeJson(out, results, overhead);
+    }
+    return 0;
+}
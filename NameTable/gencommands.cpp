@@ -0,0 +1,109 @@
+// Synthetic command file generator
+//
+// Usage: gencommands [options] output
+//
+// Writes a NameTable workload as a binary trace (see CommandFile.h), or as
+// text with -text.  The generator itself is in Workload.h.
+//
+// Options (defaults in brackets):
+//   -n count         number of commands [1000000]
+//   -scopes frac     fraction of commands that enter or exit a scope [0.1]
+//   -declares frac   fraction of commands that are declarations [0.2];
+//                    all the rest are finds
+//   -maxdepth d      scopes never nest deeper than this, at least 1 [64]
+//   -meandepth d     nesting depth drifts back toward this [8]
+//   -vocab v         number of distinct identifiers that get declared [10000]
+//   -misses v        number of distinct identifiers that are looked up but
+//                    never declared [vocab/4]
+//   -len mean        mean identifier length [8]
+//   -lenstddev sd    standard deviation of identifier length [3]
+//   -maxlen len      longest identifier [32]
+//   -shadow frac     fraction of declarations that reuse a name declared in
+//                    an enclosing scope [0.1]
+//   -hit frac        fraction of finds that are for a visible name [0.5]
+//   -zipf s          Zipf exponent of identifier popularity, 0 for uniform [1]
+//   -seed n          random seed [1]
+//   -text            write the text format instead of a binary trace
+
+#include "Workload.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+using namespace std;
+
+struct Options
+{
+    WorkloadOptions workload;
+    bool text = false;
+    const char* output = nullptr;
+};
+
+bool parseOptions(int argc, char* argv[], Options& opt)
+{
+    WorkloadOptions& w = opt.workload;
+    for (int k = 1; k < argc; k++)
+    {
+        string arg = argv[k];
+        if (arg == "-text")
+        {
+            opt.text = true;
+            continue;
+        }
+        if (arg[0] != '-')
+        {
+            if (opt.output != nullptr)
+                return false;
+            opt.output = argv[k];
+            continue;
+        }
+        if (k + 1 == argc)
+            return false;
+        const char* value = argv[++k];
+        if (arg == "-n")              w.count = strtoull(value, nullptr, 10);
+        else if (arg == "-scopes")    w.scopes = atof(value);
+        else if (arg == "-declares")  w.declares = atof(value);
+        else if (arg == "-maxdepth")  w.maxDepth = atoi(value);
+        else if (arg == "-meandepth") w.meanDepth = atof(value);
+        else if (arg == "-vocab")     w.vocab = strtoull(value, nullptr, 10);
+        else if (arg == "-misses")    w.misses = strtoull(value, nullptr, 10);
+        else if (arg == "-len")       w.meanLength = atof(value);
+        else if (arg == "-lenstddev") w.lengthStddev = atof(value);
+        else if (arg == "-maxlen")    w.maxLength = atoi(value);
+        else if (arg == "-shadow")    w.shadow = atof(value);
+        else if (arg == "-hit")       w.hit = atof(value);
+        else if (arg == "-zipf")      w.zipf = atof(value);
+        else if (arg == "-seed")      w.seed = strtoull(value, nullptr, 10);
+        else
+            return false;
+    }
+    return opt.output != nullptr  &&  w.valid();
+}
+
+int main(int argc, char* argv[])
+{
+    Options opt;
+    if (!parseOptions(argc, argv, opt))
+    {
+        cerr << "Usage: " << argv[0] << " [options] output" << endl
+             << "See the top of gencommands.cpp for the options." << endl;
+        return 2;
+    }
+
+    ofstream out(opt.output, ios::binary);
+    if ( ! out)
+    {
+        cerr << "Cannot create " << opt.output << endl;
+        return 1;
+    }
+    WorkloadSummary summary;
+    if (!writeWorkload(opt.workload, out, opt.text, summary))
+    {
+        cerr << "Error writing " << opt.output << endl;
+        return 1;
+    }
+    cout << "Wrote " << opt.workload.count << " commands (" << summary.finds << " finds, "
+         << summary.hits << " for visible names) using " << summary.identifiers
+         << " identifiers to " << opt.output << "." << endl;
+    return 0;
+}
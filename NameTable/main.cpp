@@ -5,17 +5,100 @@
 //   }                    which requests a call to exitScope
 //   identifier number    which requests a call to declare(identifier,number)
 //   identifier           which requests a call to find(identifier)
+//
+// Run as "nametable commandfile" to use another file instead.  It may be
+// in that text format or be a binary trace made by traceconvert.
+//
+// Run as "nametable -stress [levels]" to instead test a machine-generated
+// nest of scopes that is levels deep (100000 by default).
+//
+// Run as "nametable -replay commandfile" to only time a command file (such
+// as a big one from gencommands) through executeBatch, without checking it
+// against the slow table.
+//
+// Run as "nametable -streams [-threads n] commandfile..." to run many
+// independent command files at once, each through its own NameTable, on a
+// pool of 1, 2, 4, ... up to n threads (by default, as many as the machine
+// has, but at least 2), and see how the total throughput scales.
+//
+// Run as "nametable -pipeline commandfile" to time reading and parsing a
+// text command file on one thread while another runs the commands, handing
+// them over through a lock-free ring, against doing both on one thread.
+//
+// Put -perf first (as in "nametable -perf commandfile") to also have the
+// performance test report hardware event counts (cycles, instructions,
+// cache, branch and TLB misses) for each phase.  This needs Linux and a
+// kernel that lets the process count its own events.
 
 #include "NameTable.h"
+#include "BasicNameTable.h"
+#include "PersistentNameTable.h"
+#include "CommandFile.h"
+#include "Workload.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <iomanip>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
 using namespace std;
 
+  // Count every allocation made through the global operator new, so the
+  // performance test can show how much the table allocates per command.
+  // It is atomic so that tests running several threads can allocate from
+  // any of them.  A test that times many threads allocating at once turns
+  // countAllocations off first (before starting them, and back on after
+  // joining them), so they don't all contend for the counter's cache line.
+
+static atomic<unsigned long long> allocationCount(0);
+static bool countAllocations = true;
+
+  // If g++ inlines these, it sees malloc and free behind operator new and
+  // operator delete and warns that they don't match, so keep them out of
+  // line.
+
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void* operator new(size_t size)
+{
+    if (countAllocations)
+        allocationCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+NOINLINE void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
 const char* COMMAND_FILE_NAME = "commands.txt";
+bool countEvents = false;  // set by -perf
+const int DEFAULT_STRESS_LEVELS = 100000;
 
 class SlowNameTable
 {
@@ -24,6 +107,7 @@ class SlowNameTable
     bool exitScope();
     bool declare(const string& id, int lineNum);
     int find(const string& id) const;
+    vector<size_t> declarationsPerScope() const;
   private:
     vector<string> m_ids;
     vector<int> m_lines;
@@ -32,20 +116,69 @@ class SlowNameTable
 struct Command
 {
     static Command* create(string line, int lineno);
+    static Command* create(const CommandRecord& rec);
     Command(string line, int lineno) : m_line(line), m_lineno(lineno) {}
     virtual ~Command() {}
     virtual void execute(NameTable& nt) const = 0;
     virtual bool executeAndCheck(NameTable& nt, SlowNameTable& snt) const = 0;
+      // Same as executeAndCheck, but goes through the SymbolId interface
+    virtual bool executeSymbolAndCheck(NameTable& nt, SlowNameTable& snt) const
+    {
+        return executeAndCheck(nt, snt);
+    }
+      // Append this command to a batch, and compute the result executeBatch
+      // should report for it
+    virtual void addToBatch(NameTable& nt, CommandBatch& batch) const = 0;
+    virtual int executeSlow(SlowNameTable& snt) const = 0;
     string m_line;
     int m_lineno;
 };
 
 void extractCommands(istream& dataf, vector<Command*>& commands);
-string testCorrectness(const vector<Command*>& commands);
-void testPerformance(const vector<Command*>& commands);
+void extractCommands(const CommandFile& file, vector<Command*>& commands);
+string testCorrectness(const vector<Command*>& commands, bool useSymbols,
+                       ExitPolicy policy);
+void testPerformance(const vector<Command*>& commands, ExitPolicy policy);
+string testBatchCorrectness(const vector<Command*>& commands, ExitPolicy policy);
+void testBatchPerformance(const vector<Command*>& commands);
+string testFindManyCorrectness(const vector<Command*>& commands);
+string testGenericCorrectness(const vector<Command*>& commands, ExitPolicy policy);
+string testFindPointers(ExitPolicy policy);
+string testFrozenCorrectness(const vector<Command*>& commands, ExitPolicy policy);
+void testFrozenPerformance(const vector<Command*>& commands);
+string testPersistentCorrectness(const vector<Command*>& commands);
+void testPersistentPerformance(const vector<Command*>& commands);
+string testTransactionCorrectness(const vector<Command*>& commands, ExitPolicy policy);
+void testTransactionPerformance(const vector<Command*>& commands, ExitPolicy policy);
+string testStatsCorrectness(const vector<Command*>& commands, ExitPolicy policy);
+void reportStats(const vector<Command*>& commands);
+void testFindManyPerformance(const vector<Command*>& commands);
+void addToBatch(const CommandRecord& rec, NameTable& nt, CommandBatch& batch);
+string testLoadCorrectness(const vector<Command*>& commands, const char* path);
+string testStringViewCorrectness(const CommandFile& file, ExitPolicy policy);
+void testLoadPerformance(const char* path);
+int testStress(int levels);
+int testReplay(const char* path);
+int testStreams(int argc, char* argv[]);
+int testPipeline(const char* path);
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1  &&  strcmp(argv[1], "-perf") == 0)
+    {
+        countEvents = true;
+        argc--;
+        argv++;
+    }
+    if (argc > 1  &&  strcmp(argv[1], "-stress") == 0)
+        return testStress(argc > 2 ? atoi(argv[2]) : DEFAULT_STRESS_LEVELS);
+    if (argc > 2  &&  strcmp(argv[1], "-replay") == 0)
+        return testReplay(argv[2]);
+    if (argc > 1  &&  strcmp(argv[1], "-streams") == 0)
+        return testStreams(argc - 2, argv + 2);
+    if (argc > 2  &&  strcmp(argv[1], "-pipeline") == 0)
+        return testPipeline(argv[2]);
+
     vector<Command*> commands;
 
       // Basic correctness test
@@ -100,29 +233,129 @@ int main()
     extractCommands(basicf, commands);
 
     cout << "Basic correctness test: " << flush;
-    cout << testCorrectness(commands) << endl;
+    cout << testCorrectness(commands, false, EAGER_EXIT) << endl;
+    cout << "Basic symbol correctness test: " << flush;
+    cout << testCorrectness(commands, true, EAGER_EXIT) << endl;
+    cout << "Basic lazy exit correctness test: " << flush;
+    cout << testCorrectness(commands, false, LAZY_EXIT) << endl;
+    cout << "Basic find pointer test: " << flush;
+    cout << testFindPointers(EAGER_EXIT) << endl;
+    cout << "Basic lazy exit find pointer test: " << flush;
+    cout << testFindPointers(LAZY_EXIT) << endl;
 
     for (size_t k = 0; k < commands.size(); k++)
         delete commands[k];
     commands.clear();
 
+      // Small generated workloads that keep returning to the outermost
+      // scope, which is where an exit without a matching enter would make
+      // NameTable and the slow table disagree
+
+    for (int maxDepth = 1; maxDepth <= 2; maxDepth++)
+    {
+        WorkloadOptions opt;
+        opt.count = 20000;
+        opt.scopes = 0.2;
+        opt.maxDepth = maxDepth;
+        opt.meanDepth = 0;
+        opt.vocab = 300;
+        ostringstream generated;
+        WorkloadSummary summary;
+        writeWorkload(opt, generated, true, summary);
+        istringstream generatedf(generated.str());
+        extractCommands(generatedf, commands);
+
+        cout << "Generated depth " << maxDepth << " correctness test: " << flush;
+        cout << testCorrectness(commands, false, EAGER_EXIT) << endl;
+        cout << "Generated depth " << maxDepth << " symbol correctness test: " << flush;
+        cout << testCorrectness(commands, true, EAGER_EXIT) << endl;
+        cout << "Generated depth " << maxDepth << " lazy exit correctness test: " << flush;
+        cout << testCorrectness(commands, false, LAZY_EXIT) << endl;
+
+        for (size_t k = 0; k < commands.size(); k++)
+            delete commands[k];
+        commands.clear();
+    }
+
       // Thorough correctness and performance tests
 
-    ifstream thoroughf(COMMAND_FILE_NAME);
-    if ( ! thoroughf)
+    const char* path = (argc > 1 ? argv[1] : COMMAND_FILE_NAME);
+    CommandFile file;
+    if ( ! file.load(path))
     {
-        cout << "Cannot open " << COMMAND_FILE_NAME
+        cout << "Cannot open " << path
              << ", so cannot do thorough correctness or performance tests!"
              << endl;
         return 1;
     }
-    extractCommands(thoroughf, commands);
+    if (file.isBinary())
+        extractCommands(file, commands);
+    else
+    {
+        ifstream thoroughf(path);
+        extractCommands(thoroughf, commands);
+    }
 
     cout << "Thorough correctness test: " << flush;
-    cout << testCorrectness(commands) << endl;
+    cout << testCorrectness(commands, false, EAGER_EXIT) << endl;
+    cout << "Thorough symbol correctness test: " << flush;
+    cout << testCorrectness(commands, true, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit correctness test: " << flush;
+    cout << testCorrectness(commands, false, LAZY_EXIT) << endl;
+    cout << "Thorough batch correctness test: " << flush;
+    cout << testBatchCorrectness(commands, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit batch correctness test: " << flush;
+    cout << testBatchCorrectness(commands, LAZY_EXIT) << endl;
+    cout << "Thorough findMany correctness test: " << flush;
+    cout << testFindManyCorrectness(commands) << endl;
+    cout << "Thorough BasicNameTable<Attributes> correctness test: " << flush;
+    cout << testGenericCorrectness(commands, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit BasicNameTable<Attributes> correctness test: " << flush;
+    cout << testGenericCorrectness(commands, LAZY_EXIT) << endl;
+    cout << "Thorough frozen snapshot correctness test: " << flush;
+    cout << testFrozenCorrectness(commands, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit frozen snapshot correctness test: " << flush;
+    cout << testFrozenCorrectness(commands, LAZY_EXIT) << endl;
+    cout << "Thorough persistent table correctness test: " << flush;
+    cout << testPersistentCorrectness(commands) << endl;
+    cout << "Thorough transaction correctness test: " << flush;
+    cout << testTransactionCorrectness(commands, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit transaction correctness test: " << flush;
+    cout << testTransactionCorrectness(commands, LAZY_EXIT) << endl;
+    cout << "Thorough stats correctness test: " << flush;
+    cout << testStatsCorrectness(commands, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit stats correctness test: " << flush;
+    cout << testStatsCorrectness(commands, LAZY_EXIT) << endl;
+    cout << "Thorough string_view correctness test: " << flush;
+    cout << testStringViewCorrectness(file, EAGER_EXIT) << endl;
+    cout << "Thorough lazy exit string_view correctness test: " << flush;
+    cout << testStringViewCorrectness(file, LAZY_EXIT) << endl;
+    if ( ! file.isBinary())
+    {
+        cout << "mmap loader correctness test: " << flush;
+        cout << testLoadCorrectness(commands, path) << endl;
+    }
 
     cout << "Performance test on " << commands.size() << " commands: " << flush;
-    testPerformance(commands);
+    testPerformance(commands, EAGER_EXIT);
+    cout << "Lazy exit performance test on " << commands.size() << " commands: " << flush;
+    testPerformance(commands, LAZY_EXIT);
+    cout << "Batch performance test on " << commands.size() << " commands: " << flush;
+    testBatchPerformance(commands);
+    cout << "findMany performance test: " << flush;
+    testFindManyPerformance(commands);
+    cout << "Frozen snapshot parallel performance test: " << flush;
+    testFrozenPerformance(commands);
+    cout << "Persistent table performance test on " << commands.size() << " commands: " << flush;
+    testPersistentPerformance(commands);
+    cout << "Transaction performance test: " << flush;
+    testTransactionPerformance(commands, EAGER_EXIT);
+    cout << "Lazy exit transaction performance test: " << flush;
+    testTransactionPerformance(commands, LAZY_EXIT);
+    cout << "Load performance test on " << path << ": " << flush;
+    testLoadPerformance(path);
+    cout << "Table statistics after all " << commands.size() << " commands:" << endl;
+    reportStats(commands);
 
     for (size_t k = 0; k < commands.size(); k++)
         delete commands[k];
@@ -143,6 +376,15 @@ struct EnterScopeCmd : public Command
         snt.enterScope();
         return true;
     }
+    virtual void addToBatch(NameTable&, CommandBatch& batch) const
+    {
+        batch.enterScope();
+    }
+    virtual int executeSlow(SlowNameTable& snt) const
+    {
+        snt.enterScope();
+        return 1;
+    }
 };
 
 struct ExitScopeCmd : public Command
@@ -158,6 +400,14 @@ struct ExitScopeCmd : public Command
     {
         return nt.exitScope() == snt.exitScope();
     }
+    virtual void addToBatch(NameTable&, CommandBatch& batch) const
+    {
+        batch.exitScope();
+    }
+    virtual int executeSlow(SlowNameTable& snt) const
+    {
+        return snt.exitScope();
+    }
 };
 
 struct DeclareCmd : public Command
@@ -173,6 +423,18 @@ struct DeclareCmd : public Command
     {
         return nt.declare(m_id, m_lineNum) == snt.declare(m_id, m_lineNum);
     }
+    virtual bool executeSymbolAndCheck(NameTable& nt, SlowNameTable& snt) const
+    {
+        return nt.declare(nt.intern(m_id), m_lineNum) == snt.declare(m_id, m_lineNum);
+    }
+    virtual void addToBatch(NameTable& nt, CommandBatch& batch) const
+    {
+        batch.declare(nt.intern(m_id), m_lineNum);
+    }
+    virtual int executeSlow(SlowNameTable& snt) const
+    {
+        return snt.declare(m_id, m_lineNum);
+    }
     string m_id;
     int m_lineNum;
 };
@@ -190,6 +452,18 @@ struct FindCmd : public Command
     {
         return nt.find(m_id) == snt.find(m_id);
     }
+    virtual bool executeSymbolAndCheck(NameTable& nt, SlowNameTable& snt) const
+    {
+        return nt.find(nt.intern(m_id)) == snt.find(m_id);
+    }
+    virtual void addToBatch(NameTable& nt, CommandBatch& batch) const
+    {
+        batch.find(nt.intern(m_id));
+    }
+    virtual int executeSlow(SlowNameTable& snt) const
+    {
+        return snt.find(m_id);
+    }
     string m_id;
 };
 
@@ -209,6 +483,29 @@ Command* Command::create(string line, int lineno)
     return new DeclareCmd(field1, field2, line, lineno);
 }
 
+Command* Command::create(const CommandRecord& rec)
+{
+    string id(rec.id);
+    switch (rec.op)
+    {
+      case CommandBatch::ENTER_SCOPE:
+        return new EnterScopeCmd("{", rec.lineno);
+      case CommandBatch::EXIT_SCOPE:
+        return new ExitScopeCmd("}", rec.lineno);
+      case CommandBatch::DECLARE:
+        return new DeclareCmd(id, rec.lineNum, id + " " + to_string(rec.lineNum), rec.lineno);
+      default:
+        return new FindCmd(id, id, rec.lineno);
+    }
+}
+
+void extractCommands(const CommandFile& file, vector<Command*>& commands)
+{
+    const vector<CommandRecord>& recs = file.commands();
+    for (size_t k = 0; k < recs.size(); k++)
+        commands.push_back(Command::create(recs[k]));
+}
+
 void extractCommands(istream& dataf, vector<Command*>& commands)
 {
     string commandLine;
@@ -222,15 +519,18 @@ void extractCommands(istream& dataf, vector<Command*>& commands)
     }
 }
 
-string testCorrectness(const vector<Command*>& commands)
+string testCorrectness(const vector<Command*>& commands, bool useSymbols,
+                       ExitPolicy policy)
 {
-    NameTable nt;
+    NameTable nt(policy);
     SlowNameTable snt;
     for (size_t k = 0; k < commands.size(); k++)
     {
           // Check if command agrees with our behavior
 
-        if (!commands[k]->executeAndCheck(nt, snt))
+        bool ok = useSymbols ? commands[k]->executeSymbolAndCheck(nt, snt)
+                             : commands[k]->executeAndCheck(nt, snt);
+        if (!ok)
         {
             ostringstream msg;
             msg << "*** FAILED *** line " << commands[k]->m_lineno
@@ -241,129 +541,1720 @@ string testCorrectness(const vector<Command*>& commands)
     return "Passed";
 }
 
-//========================================================================
-// Timer t;                 // create a timer and start it
-// t.start();               // (re)start the timer
-// double d = t.elapsed();  // milliseconds since timer was last started
-//========================================================================
+  // Stands in for the type information a compiler would keep with each
+  // declaration.  The description is long enough to live on the heap, so
+  // the test also catches values being copied or moved wrongly.
 
-#include <chrono>
+struct Attributes
+{
+    int lineNum = -1;
+    string description;
+};
 
-class Timer
+string describe(int lineNum)
 {
-  public:
-    Timer()
-    {
-        start();
-    }
-    void start()
-    {
-        m_time = std::chrono::high_resolution_clock::now();
-    }
-    double elapsed() const
+    return "declared on line " + to_string(lineNum) + " of the command file";
+}
+
+  // The same commands through a BasicNameTable<Attributes>, whose finds
+  // must come back with the attributes the slow table's declaration had.
+
+string testGenericCorrectness(const vector<Command*>& commands, ExitPolicy policy)
+{
+    BasicNameTable<Attributes> nt(policy);
+    SlowNameTable snt;
+    for (size_t k = 0; k < commands.size(); k++)
     {
-        std::chrono::duration<double,std::milli> diff =
-                          std::chrono::high_resolution_clock::now() - m_time;
-        return diff.count();
+        const Command* cmd = commands[k];
+        bool ok;
+        if (dynamic_cast<const EnterScopeCmd*>(cmd) != nullptr)
+        {
+            nt.enterScope();
+            snt.enterScope();
+            ok = true;
+        }
+        else if (dynamic_cast<const ExitScopeCmd*>(cmd) != nullptr)
+            ok = (nt.exitScope() == snt.exitScope());
+        else if (const DeclareCmd* dc = dynamic_cast<const DeclareCmd*>(cmd))
+        {
+            Attributes attrs;
+            attrs.lineNum = dc->m_lineNum;
+            attrs.description = describe(dc->m_lineNum);
+            ok = (nt.declare(dc->m_id, attrs) == snt.declare(dc->m_id, dc->m_lineNum));
+        }
+        else
+        {
+            const FindCmd* fc = dynamic_cast<const FindCmd*>(cmd);
+            const Attributes* attrs = nt.find(string_view(fc->m_id));
+            int expected = snt.find(fc->m_id);
+            if (attrs == nullptr)
+                ok = (expected == -1);
+            else
+                ok = (attrs->lineNum == expected  &&  attrs->description == describe(expected));
+        }
+        if (!ok)
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << cmd->m_lineno
+                << ": \"" << cmd->m_line << "\"";
+            return msg.str();
+        }
     }
-  private:
-    std::chrono::high_resolution_clock::time_point m_time;
-};
+    return "Passed";
+}
+
+  // A pointer from find is only good until the table next changes, so
+  // hold one across a declaration that shadows its name the way the
+  // ReadMe says to: a write through it before then must stay with the
+  // outer declaration, and finding the name again must give the inner
+  // declaration, then the outer one with the write once the scope closes.
+  // A write inside a transaction isn't logged, so rolling back keeps it.
 
-void testPerformance(const vector<Command*>& commands)
+string testFindPointers(ExitPolicy policy)
 {
-    double endConstruction;
-    double endCommands;
+    BasicNameTable<Attributes> nt(policy);
+    nt.declare("x", Attributes{ 1, describe(1) });
+    Attributes* outer = nt.find("x");
+    if (outer == nullptr)
+        return "*** FAILED *** x not found";
+    outer->description = "written before shadowing";
 
-    Timer timer;
-    {
-        NameTable nt;
+    nt.enterScope();
+    nt.declare("x", Attributes{ 2, describe(2) });
+    const Attributes* inner = nt.find("x");
+    if (inner == nullptr  ||  inner->lineNum != 2  ||  inner->description != describe(2))
+        return "*** FAILED *** inner x not found after shadowing";
+    nt.exitScope();
+    outer = nt.find("x");
+    if (outer == nullptr  ||  outer->lineNum != 1  ||
+            outer->description != "written before shadowing")
+        return "*** FAILED *** outer x lost its write after shadowing";
 
-        endConstruction = timer.elapsed();
+    nt.begin();
+    outer->description = "written in a transaction";
+    nt.enterScope();
+    nt.declare("x", Attributes{ 3, describe(3) });
+    nt.rollback();
+    outer = nt.find("x");
+    if (outer == nullptr  ||  outer->lineNum != 1  ||
+            outer->description != "written in a transaction")
+        return "*** FAILED *** outer x wrong after rollback";
+    return "Passed";
+}
 
-        for (size_t k = 0; k < commands.size(); k++)
-            commands[k]->execute(nt);
+  // Freeze the table every so often and note what the snapshot should say
+  // for every name that is ever looked up, by string and by symbol.  After
+  // all the commands have run, every snapshot must still say exactly that,
+  // checked from several threads at once.
 
-        endCommands = timer.elapsed();
+string testFrozenCorrectness(const vector<Command*>& commands, ExitPolicy policy)
+{
+    const size_t FREEZE_EVERY = 20011;
+    const int THREADS = 4;
+
+    NameTable nt(policy);
+    SlowNameTable snt;
+    vector<string> ids;
+    vector<SymbolId> syms;
+    unordered_set<string> seen;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        const FindCmd* fc = dynamic_cast<const FindCmd*>(commands[k]);
+        if (fc != nullptr  &&  seen.insert(fc->m_id).second)
+        {
+            ids.push_back(fc->m_id);
+            syms.push_back(nt.intern(fc->m_id));
+        }
     }
 
-    double end = timer.elapsed();
+    vector<FrozenNameTable> snapshots;
+    vector<vector<int>> expected;
+    for (size_t k = 0; k <= commands.size(); k++)
+    {
+        if (k % FREEZE_EVERY == 0  ||  k == commands.size())
+        {
+            snapshots.push_back(nt.freeze());
+            expected.push_back(vector<int>());
+            for (size_t j = 0; j < ids.size(); j++)
+                expected.back().push_back(snt.find(ids[j]));
+        }
+        if (k < commands.size())
+            commands[k]->executeAndCheck(nt, snt);
+    }
 
-    cout << end << " milliseconds." << endl
-         << "   Construction: " << endConstruction << " msec." << endl
-         << "       Commands: " << (endCommands - endConstruction) << " msec." << endl
-         << "    Destruction: " << (end - endCommands) << " msec." << endl;
+    vector<size_t> failures(THREADS, 0);
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.push_back(thread([&, t]() {
+            for (size_t n = 0; n < snapshots.size(); n++)
+            {
+                for (size_t j = 0; j < ids.size(); j++)
+                {
+                    if (snapshots[n].find(ids[j]) != expected[n][j]  ||
+                        snapshots[n].find(syms[j]) != expected[n][j])
+                        failures[t]++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    for (int t = 0; t < THREADS; t++)
+    {
+        if (failures[t] != 0)
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** " << failures[t] << " wrong answers from snapshots";
+            return msg.str();
+        }
+    }
+    return "Passed";
 }
 
-void SlowNameTable::enterScope()
-{
-      // Extend the id vector with an empty string that
-      // serves as a scope entry marker.
+  // Run one command against a BasicPersistentNameTable<int> and the slow
+  // table, and report whether they agree.
 
-    m_ids.push_back("");
-    m_lines.push_back(0);
+bool executePersistentAndCheck(const Command* cmd, BasicPersistentNameTable<int>& pt,
+                               SlowNameTable& snt)
+{
+    if (dynamic_cast<const EnterScopeCmd*>(cmd) != nullptr)
+    {
+        pt.enterScope();
+        snt.enterScope();
+        return true;
+    }
+    if (dynamic_cast<const ExitScopeCmd*>(cmd) != nullptr)
+        return pt.exitScope() == snt.exitScope();
+    if (const DeclareCmd* dc = dynamic_cast<const DeclareCmd*>(cmd))
+        return pt.declare(dc->m_id, dc->m_lineNum) == snt.declare(dc->m_id, dc->m_lineNum);
+    const FindCmd* fc = dynamic_cast<const FindCmd*>(cmd);
+    const int* line = pt.find(string_view(fc->m_id));
+    return (line == nullptr ? -1 : *line) == snt.find(fc->m_id);
 }
 
-bool SlowNameTable::exitScope()
+  // Every so often, take a checkpoint, run a stretch of the commands ahead
+  // speculatively (against a copy of the slow table), then restore the
+  // checkpoint and run them again for real, as a backtracking parser
+  // would.  Checkpoints kept along the way must still give the answers
+  // they gave when they were taken once all the commands have run.
+
+string testPersistentCorrectness(const vector<Command*>& commands)
 {
-      // Remove ids back to the last scope entry.
+    const size_t SPECULATE_EVERY = 997;
+    const size_t LOOKAHEAD = 300;
+    const size_t KEEP_EVERY = 20011;
 
-    while (!m_ids.empty()  &&  m_ids.back() != "")
+    BasicPersistentNameTable<int> pt;
+    SlowNameTable snt;
+    vector<string> ids;
+    unordered_set<string> seen;
+    for (size_t k = 0; k < commands.size(); k++)
     {
-        m_ids.pop_back();
-        m_lines.pop_back();
+        const FindCmd* fc = dynamic_cast<const FindCmd*>(commands[k]);
+        if (fc != nullptr  &&  seen.insert(fc->m_id).second)
+            ids.push_back(fc->m_id);
     }
-    if (m_ids.empty())
-        return false;
 
-      // Remove the scope entry marker itself.
+    vector<BasicPersistentNameTable<int>::Checkpoint> kept;
+    vector<vector<int>> expected;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        if (k % KEEP_EVERY == 0)
+        {
+            kept.push_back(pt.checkpoint());
+            expected.push_back(vector<int>());
+            for (size_t j = 0; j < ids.size(); j++)
+                expected.back().push_back(snt.find(ids[j]));
+        }
+        if (k % SPECULATE_EVERY == 0)
+        {
+            BasicPersistentNameTable<int>::Checkpoint cp = pt.checkpoint();
+            SlowNameTable ahead = snt;
+            for (size_t j = k; j < min(k + LOOKAHEAD, commands.size()); j++)
+            {
+                if ( ! executePersistentAndCheck(commands[j], pt, ahead))
+                {
+                    ostringstream msg;
+                    msg << "*** FAILED *** speculating at line " << commands[j]->m_lineno
+                        << ": \"" << commands[j]->m_line << "\"";
+                    return msg.str();
+                }
+            }
+            pt.restore(cp);
+        }
+        if ( ! executePersistentAndCheck(commands[k], pt, snt))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
 
-    m_ids.pop_back();
-    m_lines.pop_back();
-    return true;
+    for (size_t n = 0; n < kept.size(); n++)
+    {
+        pt.restore(kept[n]);
+        for (size_t j = 0; j < ids.size(); j++)
+        {
+            const int* line = pt.find(string_view(ids[j]));
+            if ((line == nullptr ? -1 : *line) != expected[n][j])
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** checkpoint " << n << " finds " << ids[j]
+                    << " on the wrong line";
+                return msg.str();
+            }
+        }
+    }
+    return "Passed";
 }
 
-bool SlowNameTable::declare(const string& id, int lineNum)
-{
-    if (id.empty())
-        return false;
+  // Every so often, run a stretch of the commands inside a transaction
+  // (against a copy of the slow table), with a nested transaction over its
+  // second half.  The inner one is rolled back or committed, and then so is
+  // the outer one; whatever was rolled back is run again for real.  After
+  // each rollback, stats() must count the same declarations in each scope
+  // as the slow table.
 
-      // Check for another declaration in the same scope.
-      // Return if found, break out if encounter the scope
-      // entry marker.
+string testTransactionCorrectness(const vector<Command*>& commands, ExitPolicy policy)
+{
+    const size_t SPECULATE_EVERY = 997;
+    const size_t LOOKAHEAD = 300;
 
-    size_t k = m_ids.size();
-    while (k > 0)
+    NameTable nt(policy);
+    SlowNameTable snt;
+    size_t tries = 0;
+    for (size_t k = 0; k < commands.size(); )
     {
-        k--;
-        if (m_ids[k].empty())
-            break;
-        if (m_ids[k] == id)
-            return false;
-    }
+        if (k % SPECULATE_EVERY != 0)
+        {
+            if ( ! commands[k]->executeAndCheck(nt, snt))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** line " << commands[k]->m_lineno
+                    << ": \"" << commands[k]->m_line << "\"";
+                return msg.str();
+            }
+            k++;
+            continue;
+        }
 
-      // Save the declaration
+        size_t end = min(k + LOOKAHEAD, commands.size());
+        size_t mid = k + (end - k) / 2;
+        SlowNameTable ahead = snt;
+        SlowNameTable middle;
+        nt.begin();
+        for (size_t j = k; j < end; j++)
+        {
+            if (j == mid)
+            {
+                nt.begin();
+                middle = ahead;
+            }
+            if ( ! commands[j]->executeAndCheck(nt, ahead))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** in a transaction at line " << commands[j]->m_lineno
+                    << ": \"" << commands[j]->m_line << "\"";
+                return msg.str();
+            }
+        }
 
-    m_ids.push_back(id);
-    m_lines.push_back(lineNum);
-    return true;
+          // Roll back the inner transaction every other time, and commit
+          // the outer one every third time
+
+        size_t next = end;
+        if (tries % 2 == 0)
+        {
+            if ( ! nt.rollback())
+                return "*** FAILED *** rollback of a nested transaction returned false";
+            ahead = middle;
+            next = mid;
+            if (nt.stats().liveDeclarations != ahead.declarationsPerScope())
+                return "*** FAILED *** wrong declarations after rolling back a nested transaction";
+        }
+        else if ( ! nt.commit())
+            return "*** FAILED *** commit of a nested transaction returned false";
+        if (tries % 3 == 0)
+        {
+            if ( ! nt.commit())
+                return "*** FAILED *** commit returned false";
+            snt = ahead;
+            k = next;
+        }
+        else
+        {
+            if ( ! nt.rollback())
+                return "*** FAILED *** rollback returned false";
+            if (nt.stats().liveDeclarations != snt.declarationsPerScope())
+                return "*** FAILED *** wrong declarations after rolling back a transaction";
+            if ( ! commands[k]->executeAndCheck(nt, snt))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** line " << commands[k]->m_lineno
+                    << ": \"" << commands[k]->m_line << "\"";
+                return msg.str();
+            }
+            k++;
+        }
+        tries++;
+    }
+    if (nt.commit()  ||  nt.rollback())
+        return "*** FAILED *** commit or rollback with no transaction open returned true";
+    return "Passed";
 }
 
-int SlowNameTable::find(const string& id) const
+  // Every so often, the declarations stats() counts in each scope must
+  // match the slow table's, the probe length histogram must account for
+  // every symbol, and the find counter must have seen every find (or, in
+  // a build without NAMETABLE_STATS, none).
+
+string testStatsCorrectness(const vector<Command*>& commands, ExitPolicy policy)
 {
-    if (id.empty())
-        return -1;
+    const size_t CHECK_EVERY = 997;
+    NameTable nt(policy);
+    SlowNameTable snt;
+    unsigned long long finds = 0;
+    bool changed = false;  // finds on a table never changed aren't counted
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        commands[k]->executeAndCheck(nt, snt);
+        if (dynamic_cast<const FindCmd*>(commands[k]) != nullptr)
+        {
+            if (changed)
+                finds++;
+        }
+        else if (dynamic_cast<const ExitScopeCmd*>(commands[k]) == nullptr)
+            changed = true;
+        if (k % CHECK_EVERY != 0  &&  k + 1 != commands.size())
+            continue;
+        NameTableStats st = nt.stats();
+        size_t probed = 0;
+        for (size_t j = 0; j < st.probeLengths.size(); j++)
+            probed += st.probeLengths[j];
+        if (st.liveDeclarations != snt.declarationsPerScope()  ||
+            probed != st.symbols  ||  st.finds != (NAMETABLE_STATS ? finds : 0)  ||
+            (policy == EAGER_EXIT  &&  st.staleDeclarations != 0))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** stats after line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
 
-      // Search back for the most recent declaration still
-      // available.
+void reportStats(const vector<Command*>& commands)
+{
+    NameTable nt;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->execute(nt);
+    NameTableStats st = nt.stats();
 
-    size_t k = m_ids.size();
-    while (k > 0)
+    size_t live = 0;
+    for (size_t d = 0; d < st.liveDeclarations.size(); d++)
+        live += st.liveDeclarations[d];
+    unsigned long long displaced = 0;
+    for (size_t j = 0; j < st.probeLengths.size(); j++)
+        displaced += j * st.probeLengths[j];
+    cout << "        Symbols: " << st.symbols << " in " << st.slots << " slots (load factor "
+         << st.loadFactor << ")." << endl
+         << "   Probe length: " << (st.symbols == 0 ? 0 : 1 + static_cast<double>(displaced) / st.symbols)
+         << " slots on average to find a symbol, " << st.probeLengths.size() << " at most." << endl
+         << "   Declarations: " << live << " live in " << st.liveDeclarations.size() << " open scopes." << endl
+         << "     Bytes used: " << st.bytesUsed << "." << endl;
+    if ( ! NAMETABLE_STATS)
     {
-        k--;
-        if (m_ids[k] == id)
-            return m_lines[k];
+        cout << "  Name lookups: not counted (build with -DNAMETABLE_STATS=1)." << endl;
+        return;
     }
-    return -1;
+    cout << "  Name lookups: " << st.lookups << " probing "
+         << (st.lookups == 0 ? 0 : static_cast<double>(st.lookupProbes) / st.lookups)
+         << " slots each." << endl
+         << "         Filter: answered " << st.filterRejects << " of " << st.finds
+         << " finds without probing." << endl;
 }
 
+  // Nest levels scopes, shadowing one name at every level and leaving a
+  // name behind every 1000 levels, then unwind them all.  The extra "}"
+  // at the end must fail.
+
+int testStress(int levels)
+{
+    ostringstream cmds;
+    cmds << "x 0\n";
+    for (int d = 1; d <= levels; d++)
+    {
+        cmds << "{\nx " << d << "\nx\n";
+        if (d % 1000 == 0)
+            cmds << "v" << d << " " << d << "\nv" << d << "\n";
+    }
+    cmds << "v1000\n";
+    for (int d = levels; d >= 1; d--)
+    {
+        cmds << "}\n";
+        if (d % 1000 == 0)
+            cmds << "x\nv" << d << "\n";
+    }
+    cmds << "x\n}\n";
+
+    istringstream stressf(cmds.str());
+    vector<Command*> commands;
+    extractCommands(stressf, commands);
+
+    cout << "Stress correctness test, " << levels << " levels: " << flush;
+    string result = testCorrectness(commands, false, EAGER_EXIT);
+    cout << result << endl;
+    cout << "Stress lazy exit correctness test: " << flush;
+    string lazyResult = testCorrectness(commands, false, LAZY_EXIT);
+    cout << lazyResult << endl;
+
+    cout << "Stress performance test on " << commands.size() << " commands: " << flush;
+    testPerformance(commands, EAGER_EXIT);
+    cout << "Stress lazy exit performance test: " << flush;
+    testPerformance(commands, LAZY_EXIT);
+
+    for (size_t k = 0; k < commands.size(); k++)
+        delete commands[k];
+    return result == "Passed"  &&  lazyResult == "Passed" ? 0 : 1;
+}
+
+string testBatchCorrectness(const vector<Command*>& commands, ExitPolicy policy)
+{
+    NameTable nt(policy);
+    CommandBatch batch;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->addToBatch(nt, batch);
+    vector<int> results(batch.size());
+    nt.executeBatch(batch, results.data());
+
+    SlowNameTable snt;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        if (results[k] != commands[k]->executeSlow(snt))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+  // Runs of consecutive finds are resolved with one findMany call each.
+
+string testFindManyCorrectness(const vector<Command*>& commands)
+{
+    NameTable nt;
+    SlowNameTable snt;
+    vector<const FindCmd*> group;
+    vector<string_view> ids;
+    vector<int> lines;
+    for (size_t k = 0; k <= commands.size(); k++)
+    {
+        const FindCmd* fc = nullptr;
+        if (k < commands.size())
+            fc = dynamic_cast<const FindCmd*>(commands[k]);
+        if (fc != nullptr)
+        {
+            group.push_back(fc);
+            continue;
+        }
+        if (!group.empty())
+        {
+            ids.clear();
+            for (size_t j = 0; j < group.size(); j++)
+                ids.push_back(group[j]->m_id);
+            lines.resize(group.size());
+            nt.findMany(ids.data(), ids.size(), lines.data());
+            for (size_t j = 0; j < group.size(); j++)
+            {
+                if (lines[j] != snt.find(group[j]->m_id))
+                {
+                    ostringstream msg;
+                    msg << "*** FAILED *** line " << group[j]->m_lineno
+                        << ": \"" << group[j]->m_line << "\"";
+                    return msg.str();
+                }
+            }
+            group.clear();
+        }
+        if (k < commands.size()  &&  !commands[k]->executeAndCheck(nt, snt))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+void addToBatch(const CommandRecord& rec, NameTable& nt, CommandBatch& batch)
+{
+    switch (rec.op)
+    {
+      case CommandBatch::ENTER_SCOPE:  batch.enterScope();                          break;
+      case CommandBatch::EXIT_SCOPE:   batch.exitScope();                           break;
+      case CommandBatch::DECLARE:      batch.declare(nt.intern(rec.id), rec.lineNum); break;
+      case CommandBatch::FIND:         batch.find(nt.intern(rec.id));               break;
+    }
+}
+
+  // Runs the loaded records straight through the string_view interface,
+  // with ids that point into the mapped file.  Besides agreeing with the
+  // slow table, no find may allocate.
+
+string testStringViewCorrectness(const CommandFile& file, ExitPolicy policy)
+{
+    const vector<CommandRecord>& recs = file.commands();
+    NameTable nt(policy);
+    SlowNameTable snt;
+    for (size_t k = 0; k < recs.size(); k++)
+    {
+        const CommandRecord& rec = recs[k];
+        bool ok = true;
+        switch (rec.op)
+        {
+          case CommandBatch::ENTER_SCOPE:
+            nt.enterScope();
+            snt.enterScope();
+            break;
+          case CommandBatch::EXIT_SCOPE:
+            ok = (nt.exitScope() == snt.exitScope());
+            break;
+          case CommandBatch::DECLARE:
+            ok = (nt.declare(rec.id, rec.lineNum) == snt.declare(string(rec.id), rec.lineNum));
+            break;
+          case CommandBatch::FIND:
+          {
+            unsigned long long before = allocationCount;
+            int line = nt.find(rec.id);
+            if (allocationCount != before)
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** find allocated at line " << rec.lineno
+                    << ": \"" << rec.id << "\"";
+                return msg.str();
+            }
+            ok = (line == snt.find(string(rec.id)));
+            break;
+          }
+        }
+        if (!ok)
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << rec.lineno << ": \"" << rec.id << "\"";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+  // The mmap loader must see exactly the commands extractCommands does.
+
+string testLoadCorrectness(const vector<Command*>& commands, const char* path)
+{
+    CommandFile file;
+    if (!file.load(path))
+        return string("*** FAILED *** cannot load ") + path;
+    const vector<CommandRecord>& recs = file.commands();
+
+    NameTable nt;
+    CommandBatch expected;
+    CommandBatch loaded;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->addToBatch(nt, expected);
+    for (size_t k = 0; k < recs.size(); k++)
+        addToBatch(recs[k], nt, loaded);
+    if (loaded.size() != expected.size())
+        return "*** FAILED *** loaded a different number of commands";
+    for (size_t k = 0; k < loaded.size(); k++)
+    {
+        if (loaded.ops[k] != expected.ops[k]  ||
+            loaded.symbols[k] != expected.symbols[k]  ||
+            loaded.lines[k] != expected.lines[k]  ||
+            recs[k].lineno != commands[k]->m_lineno)
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+//========================================================================
+// Timer t;                 // create a timer and start it
+// t.start();               // (re)start the timer
+// double d = t.elapsed();  // milliseconds since timer was last started
+//========================================================================
+
+#include <chrono>
+
+class Timer
+{
+  public:
+    Timer()
+    {
+        start();
+    }
+    void start()
+    {
+        m_time = std::chrono::high_resolution_clock::now();
+    }
+    double elapsed() const
+    {
+        std::chrono::duration<double,std::milli> diff =
+                          std::chrono::high_resolution_clock::now() - m_time;
+        return diff.count();
+    }
+  private:
+    std::chrono::high_resolution_clock::time_point m_time;
+};
+
+//========================================================================
+// PerfCounters pc;           // open the hardware event counters
+// pc.available()             // false if none could be opened
+// pc.read(counts);           // counts[e] = events so far, or -1 if event
+//                            //   e isn't available on this machine or
+//                            //   the kernel has never scheduled it
+//========================================================================
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+class PerfCounters
+{
+  public:
+    enum Event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES,
+                 BRANCH_MISSES, DTLB_MISSES, NUM_EVENTS };
+    static const char* name(int e)
+    {
+        static const char* names[NUM_EVENTS] = {
+            "cycles", "instructions", "L1d misses", "LLC misses",
+            "branch misses", "dTLB misses"
+        };
+        return names[e];
+    }
+#if defined(__linux__)
+    PerfCounters()
+     : m_error(0)
+    {
+        static const unsigned cacheMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        static const struct { unsigned type; unsigned long long config; } events[NUM_EVENTS] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cacheMiss },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cacheMiss },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cacheMiss },
+        };
+          // Each event gets its own counter rather than joining a group, so
+          // a machine that lacks one event still counts the others.  If there
+          // are more events than hardware counters, the kernel takes turns
+          // and read() scales the counts up by how long each one ran.
+        for (int e = 0; e < NUM_EVENTS; e++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[e].type;
+            attr.config = events[e].config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            m_fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (m_fds[e] < 0)
+                m_error = errno;
+        }
+    }
+    ~PerfCounters()
+    {
+        for (int e = 0; e < NUM_EVENTS; e++)
+            if (m_fds[e] >= 0)
+                close(m_fds[e]);
+    }
+    bool available() const
+    {
+        for (int e = 0; e < NUM_EVENTS; e++)
+            if (m_fds[e] >= 0)
+                return true;
+        return false;
+    }
+    const char* error() const
+    {
+        return m_error != 0 ? strerror(m_error) : "";
+    }
+    void read(long long counts[NUM_EVENTS]) const
+    {
+        for (int e = 0; e < NUM_EVENTS; e++)
+        {
+            unsigned long long v[3];  // value, time enabled, time running
+            counts[e] = -1;
+              // An event that never got a hardware counter has no count to
+              // scale up, which isn't the same as a count of 0
+            if (m_fds[e] >= 0  &&  ::read(m_fds[e], v, sizeof(v)) == sizeof(v)  &&  v[2] != 0)
+                counts[e] = static_cast<long long>(static_cast<double>(v[0]) * v[1] / v[2]);
+        }
+    }
+  private:
+    int m_fds[NUM_EVENTS];
+    int m_error;
+#else
+    bool available() const { return false; }
+    const char* error() const { return "not supported on this platform"; }
+    void read(long long counts[NUM_EVENTS]) const
+    {
+        for (int e = 0; e < NUM_EVENTS; e++)
+            counts[e] = -1;
+    }
+#endif
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+};
+
+  // Print the events counted in each phase of a test, with the counts for
+  // the phase at index perPhase also divided by perCount.
+
+void reportCounters(const char* const phases[], long long snapshots[][PerfCounters::NUM_EVENTS],
+                    int numPhases, int perPhase, size_t perCount)
+{
+    cout << "   " << setw(14) << "Events" << " |";
+    for (int p = 0; p < numPhases; p++)
+        cout << setw(14) << phases[p];
+    cout << setw(14) << "per command" << endl;
+    for (int e = 0; e < PerfCounters::NUM_EVENTS; e++)
+    {
+        cout << "   " << setw(14) << PerfCounters::name(e) << " |";
+        for (int p = 0; p <= numPhases; p++)
+        {
+            int phase = (p < numPhases ? p : perPhase);
+            long long before = snapshots[phase][e];
+            long long after = snapshots[phase + 1][e];
+            if (before < 0  ||  after < 0)
+                cout << setw(14) << "n/a";
+            else if (p < numPhases)
+                cout << setw(14) << (after - before);
+            else
+            {
+                ostringstream ratio;
+                ratio << fixed << setprecision(2)
+                      << static_cast<double>(after - before) / max<size_t>(perCount, 1);
+                cout << setw(14) << ratio.str();
+            }
+        }
+        cout << endl;
+    }
+}
+
+void testPerformance(const vector<Command*>& commands, ExitPolicy policy)
+{
+    double endConstruction;
+    double startCommands;
+    double endCommands;
+    double startDestruction;
+    unsigned long long commandAllocations;
+
+      // Counters are read at each boundary between phases.  A read is a
+      // system call, so the clock is read just before it, to end one phase,
+      // and just after it, to start the next, which keeps the reads out of
+      // every timed phase.
+    PerfCounters* counters = (countEvents ? new PerfCounters : nullptr);
+    long long snapshots[4][PerfCounters::NUM_EVENTS];
+    if (counters != nullptr)
+        counters->read(snapshots[0]);
+
+    Timer timer;
+    {
+        NameTable nt(policy);
+
+        endConstruction = timer.elapsed();
+        if (counters != nullptr)
+            counters->read(snapshots[1]);
+        startCommands = timer.elapsed();
+        unsigned long long startAllocations = allocationCount;
+
+        for (size_t k = 0; k < commands.size(); k++)
+            commands[k]->execute(nt);
+
+        endCommands = timer.elapsed();
+        commandAllocations = allocationCount - startAllocations;
+        if (counters != nullptr)
+            counters->read(snapshots[2]);
+        startDestruction = timer.elapsed();
+    }
+
+    double end = timer.elapsed();
+    if (counters != nullptr)
+        counters->read(snapshots[3]);
+
+    double construction = endConstruction;
+    double executing = endCommands - startCommands;
+    double destruction = end - startDestruction;
+    cout << (construction + executing + destruction) << " milliseconds." << endl
+         << "   Construction: " << construction << " msec." << endl
+         << "       Commands: " << executing << " msec." << endl
+         << "    Destruction: " << destruction << " msec." << endl
+         << "    Allocations: " << commandAllocations << " during commands ("
+         << static_cast<double>(commandAllocations) / commands.size() << " per command)." << endl;
+    if (counters != nullptr)
+    {
+        if (counters->available())
+        {
+            static const char* const phases[] = { "construction", "commands", "destruction" };
+            reportCounters(phases, snapshots, 3, 1, commands.size());
+        }
+        else
+            cout << "   Hardware event counters unavailable: " << counters->error() << endl;
+        delete counters;
+    }
+
+      // Many short-lived tables, as when one is built per function body
+
+    const int NUM_TABLES = 100000;
+    const size_t FEW_COMMANDS = 10;
+    timer.start();
+    for (int n = 0; n < NUM_TABLES; n++)
+        NameTable nt(policy);
+    double endEmpty = timer.elapsed();
+    timer.start();
+    for (int n = 0; n < NUM_TABLES; n++)
+    {
+        NameTable nt(policy);
+        for (size_t k = 0; k < FEW_COMMANDS  &&  k < commands.size(); k++)
+            commands[k]->execute(nt);
+    }
+    double endFew = timer.elapsed();
+
+    cout << "    Empty table: " << (endEmpty * 1e6 / NUM_TABLES) << " nsec each." << endl
+         << "  10-cmd tables: " << (endFew * 1e6 / NUM_TABLES) << " nsec each." << endl;
+}
+
+  // Interning happens before the clock starts, since a front end that
+  // batches its commands already has the symbols.
+
+void testBatchPerformance(const vector<Command*>& commands)
+{
+    NameTable nt;
+    CommandBatch batch;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->addToBatch(nt, batch);
+    vector<int> results(batch.size());
+
+    Timer timer;
+    nt.executeBatch(batch, results.data());
+    cout << timer.elapsed() << " milliseconds." << endl;
+}
+
+  // Look up the id of every find command against the table that is left
+  // after running all the commands, first one at a time and then all at
+  // once with findMany.
+
+void testFindManyPerformance(const vector<Command*>& commands)
+{
+    NameTable nt;
+    vector<const FindCmd*> finds;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        commands[k]->execute(nt);
+        const FindCmd* fc = dynamic_cast<const FindCmd*>(commands[k]);
+        if (fc != nullptr)
+            finds.push_back(fc);
+    }
+    vector<string_view> ids;
+    for (size_t k = 0; k < finds.size(); k++)
+        ids.push_back(finds[k]->m_id);
+    vector<int> lines(ids.size());
+
+    Timer timer;
+    for (size_t k = 0; k < finds.size(); k++)
+        lines[k] = nt.find(finds[k]->m_id);
+    double oneAtATime = timer.elapsed();
+    timer.start();
+    nt.findMany(ids.data(), ids.size(), lines.data());
+    double together = timer.elapsed();
+
+    cout << finds.size() << " lookups." << endl
+         << "  One at a time: " << oneAtATime << " msec." << endl
+         << "       findMany: " << together << " msec." << endl;
+}
+
+  // Freeze the table where it holds the most declarations, then look up the
+  // id of every find command in the snapshot from 1, 2, 4, ... threads at
+  // once, each doing the same amount of work, to show how total throughput
+  // grows with the threads.
+
+void testFrozenPerformance(const vector<Command*>& commands)
+{
+    const int ROUNDS = 10;
+    const size_t SAMPLE_EVERY = 1000;
+
+    FrozenNameTable frozen = NameTable().freeze();
+    double freezeTime = 0;
+    {
+        NameTable nt;
+        size_t most = 0;
+        for (size_t k = 0; k < commands.size(); k++)
+        {
+            commands[k]->execute(nt);
+            if (k % SAMPLE_EVERY != 0)
+                continue;
+            NameTableStats s = nt.stats();
+            size_t live = 0;
+            for (size_t d = 0; d < s.liveDeclarations.size(); d++)
+                live += s.liveDeclarations[d];
+            if (live > most)
+            {
+                most = live;
+                Timer timer;
+                frozen = nt.freeze();
+                freezeTime = timer.elapsed();
+            }
+        }
+    }
+    vector<string_view> ids;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        const FindCmd* fc = dynamic_cast<const FindCmd*>(commands[k]);
+        if (fc != nullptr)
+            ids.push_back(fc->m_id);
+    }
+
+    unsigned int cores = thread::hardware_concurrency();
+    unsigned int maxThreads = max(2u, cores);
+    cout << ids.size() * ROUNDS << " lookups per thread in a snapshot of "
+         << frozen.size() << " names (frozen in " << freezeTime << " msec), "
+         << cores << " hardware threads." << endl;
+
+    double single = 0;
+    for (unsigned int n = 1; n <= maxThreads; n *= 2)
+    {
+          // Each thread starts at a different place so they don't march
+          // through the same cache lines in lockstep
+        struct alignas(64) Sink { long long sum = 0; };
+        vector<Sink> sinks(n);
+        vector<thread> threads;
+        Timer timer;
+        for (unsigned int t = 0; t < n; t++)
+        {
+            threads.push_back(thread([&, t]() {
+                size_t start = ids.size() / n * t;
+                long long sum = 0;
+                for (int r = 0; r < ROUNDS; r++)
+                {
+                    for (size_t k = start; k < ids.size(); k++)
+                        sum += frozen.find(ids[k]);
+                    for (size_t k = 0; k < start; k++)
+                        sum += frozen.find(ids[k]);
+                }
+                sinks[t].sum = sum;
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        double elapsed = timer.elapsed();
+        double perSec = ids.size() * ROUNDS * n / elapsed / 1000;
+        if (n == 1)
+            single = perSec;
+        ostringstream rate;
+        rate << fixed << setprecision(1) << perSec << " million lookups/sec ("
+             << setprecision(2) << perSec / single << "x)";
+        cout << "  " << setw(3) << n << " threads: " << rate.str() << endl;
+    }
+}
+
+  // Run all the commands through a persistent table, then time what a
+  // backtracking parser does at each decision point: take a checkpoint, run
+  // ahead a little, and restore the checkpoint.
+
+void testPersistentPerformance(const vector<Command*>& commands)
+{
+    const size_t LOOKAHEAD = 10;
+
+    BasicPersistentNameTable<int> pt;
+    vector<const DeclareCmd*> declares;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        const DeclareCmd* dc = dynamic_cast<const DeclareCmd*>(commands[k]);
+        if (dc != nullptr)
+            declares.push_back(dc);
+    }
+
+    Timer timer;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        const Command* cmd = commands[k];
+        if (dynamic_cast<const EnterScopeCmd*>(cmd) != nullptr)
+            pt.enterScope();
+        else if (dynamic_cast<const ExitScopeCmd*>(cmd) != nullptr)
+            pt.exitScope();
+        else if (const DeclareCmd* dc = dynamic_cast<const DeclareCmd*>(cmd))
+            pt.declare(dc->m_id, dc->m_lineNum);
+        else
+            pt.find(string_view(static_cast<const FindCmd*>(cmd)->m_id));
+    }
+    double runTime = timer.elapsed();
+
+    vector<SymbolId> syms;
+    for (size_t k = 0; k < declares.size(); k++)
+        syms.push_back(pt.intern(declares[k]->m_id));
+    pt.enterScope();
+    timer.start();
+    for (size_t k = 0; k + LOOKAHEAD <= syms.size(); k += LOOKAHEAD)
+    {
+        BasicPersistentNameTable<int>::Checkpoint cp = pt.checkpoint();
+        for (size_t j = k; j < k + LOOKAHEAD; j++)
+            pt.declare(syms[j], declares[j]->m_lineNum);
+        pt.restore(cp);
+    }
+    double speculateTime = timer.elapsed();
+    size_t tries = syms.size() / LOOKAHEAD;
+
+    cout << runTime << " milliseconds." << endl
+         << "  Speculation: " << tries << " tries of " << LOOKAHEAD << " declarations, "
+         << (tries == 0 ? 0 : speculateTime * 1e6 / tries) << " nsec each." << endl;
+}
+
+  // Every so often, run a stretch of the commands in a transaction and roll
+  // it back, and compare what that costs with rebuilding the table from
+  // scratch up to the same point.
+
+void testTransactionPerformance(const vector<Command*>& commands, ExitPolicy policy)
+{
+    const size_t SPECULATE_EVERY = 997;
+    const size_t LOOKAHEAD = 300;
+
+    NameTable nt(policy);
+    double speculateTime = 0;
+    size_t tries = 0;
+    Timer timer;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        if (k % SPECULATE_EVERY == 0)
+        {
+            timer.start();
+            nt.begin();
+            for (size_t j = k; j < min(k + LOOKAHEAD, commands.size()); j++)
+                commands[j]->execute(nt);
+            nt.rollback();
+            speculateTime += timer.elapsed();
+            tries++;
+        }
+        commands[k]->execute(nt);
+    }
+
+      // On average, a rebuild replays half the commands
+
+    timer.start();
+    {
+        NameTable rebuilt(policy);
+        for (size_t k = 0; k < commands.size() / 2; k++)
+            commands[k]->execute(rebuilt);
+    }
+    double rebuildTime = timer.elapsed();
+
+    cout << tries << " rollbacks of " << LOOKAHEAD << " commands." << endl
+         << "  Run and roll back: " << speculateTime * 1000 / tries << " usec each." << endl
+         << "  Rebuild instead: " << rebuildTime * 1000 << " usec each." << endl;
+}
+
+void testLoadPerformance(const char* path)
+{
+    bool binary;
+    {
+        CommandFile file;
+        binary = file.load(path)  &&  file.isBinary();
+    }
+
+    Timer timer;
+    unsigned long long startAllocations = allocationCount;
+    size_t extracted = 0;
+    if ( ! binary)
+    {
+        ifstream f(path);
+        vector<Command*> commands;
+        extractCommands(f, commands);
+        extracted = commands.size();
+        for (size_t k = 0; k < commands.size(); k++)
+            delete commands[k];
+    }
+    double getlineTime = timer.elapsed();
+    unsigned long long getlineAllocations = allocationCount - startAllocations;
+
+    timer.start();
+    startAllocations = allocationCount;
+    size_t mapped;
+    {
+        CommandFile file;
+        file.load(path);
+        mapped = file.commands().size();
+    }
+    double mmapTime = timer.elapsed();
+    unsigned long long mmapAllocations = allocationCount - startAllocations;
+
+    cout << endl;
+    if ( ! binary)
+        cout << "        getline: " << getlineTime << " msec, " << extracted << " commands, "
+             << getlineAllocations << " allocations." << endl;
+    cout << (binary ? "   binary trace: " : "           mmap: ")
+         << mmapTime << " msec, " << mapped << " commands, "
+         << mmapAllocations << " allocations." << endl;
+}
+
+  // Interning every name and building each batch is left off the clock,
+  // so the time is what the table itself spends.
+
+  // Runs an opened command file through executeBatch a chunk at a time,
+  // decoding each chunk from the mapping just before it runs, so only one
+  // chunk of records is ever in memory.  Returns a checksum of all the
+  // results.  If executing isn't nullptr, the time spent in executeBatch is
+  // added to it; if count isn't nullptr, it's set to the number of commands.
+
+unsigned long long replayCommands(CommandFile& file, NameTable& nt, double* executing, size_t* count)
+{
+    const size_t CHUNK = 65536;
+
+    vector<SymbolId> symbols;  // by string table index, for a binary trace
+    for (size_t k = 0; k < file.strings().size(); k++)
+        symbols.push_back(nt.intern(file.strings()[k]));
+
+    vector<CommandRecord> recs;
+    recs.reserve(CHUNK);
+    CommandBatch batch;
+    vector<int> results(CHUNK);
+    unsigned long long checksum = 0;
+    size_t total = 0;
+    file.rewind();
+    while (file.next(recs, CHUNK) > 0)
+    {
+        batch.clear();
+        for (size_t k = 0; k < recs.size(); k++)
+        {
+            if (recs[k].idIndex < 0)
+                addToBatch(recs[k], nt, batch);
+            else if (recs[k].op == CommandBatch::DECLARE)
+                batch.declare(symbols[recs[k].idIndex], recs[k].lineNum);
+            else
+                batch.find(symbols[recs[k].idIndex]);
+        }
+        Timer timer;
+        nt.executeBatch(batch, results.data());
+        if (executing != nullptr)
+            *executing += timer.elapsed();
+        for (size_t k = 0; k < recs.size(); k++)
+            checksum = checksum * 1000003 + static_cast<unsigned>(results[k]);
+        total += recs.size();
+    }
+    if (count != nullptr)
+        *count = total;
+    return checksum;
+}
+
+int testReplay(const char* path)
+{
+    Timer timer;
+    CommandFile file;
+    if ( ! file.open(path))
+    {
+        cout << "Cannot load " << path << endl;
+        return 1;
+    }
+    cout << "Opened " << path << " in " << timer.elapsed() << " msec." << endl;
+
+    NameTable nt;
+    double executing = 0;
+    size_t count;
+    timer.start();
+    replayCommands(file, nt, &executing, &count);
+    double elapsed = timer.elapsed();
+    if (file.failed())
+    {
+        cout << "Cannot load " << path << ": corrupt trace" << endl;
+        return 1;
+    }
+
+    cout << "Decoded and executed " << count << " commands in " << elapsed << " msec." << endl;
+    cout << "Executed them in " << executing << " msec ("
+         << (executing > 0 ? count / executing / 1000 : 0)
+         << " million commands/sec)." << endl;
+    return 0;
+}
+
+  // Runs task(0) through task(count-1) on a pool of threads.  Each thread
+  // gets its own queue of tasks, dealt out round robin, and works from the
+  // front of it; one whose queue runs dry steals from the back of another
+  // thread's, so a few long tasks don't leave the rest of the pool idle.
+
+void runWorkStealing(unsigned threads, size_t count, const function<void(size_t)>& task)
+{
+    struct alignas(64) WorkQueue
+    {
+        mutex lock;
+        deque<size_t> tasks;
+    };
+    vector<WorkQueue> queues(threads);
+    for (size_t k = 0; k < count; k++)
+        queues[k % threads].tasks.push_back(k);
+
+      // No task is added once the pool starts, so a thread that finds every
+      // queue empty is done
+    auto take = [&](unsigned t, size_t& k) {
+        for (unsigned n = 0; n < threads; n++)
+        {
+            WorkQueue& q = queues[(t + n) % threads];
+            lock_guard<mutex> guard(q.lock);
+            if (q.tasks.empty())
+                continue;
+            if (n == 0)
+            {
+                k = q.tasks.front();
+                q.tasks.pop_front();
+            }
+            else
+            {
+                k = q.tasks.back();
+                q.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.push_back(thread([&, t]() {
+            size_t k;
+            while (take(t, k))
+                task(k);
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+  // Each command file is a stream with its own NameTable.  The streams run
+  // on 1, 2, 4, ... threads, and every run must produce exactly the results
+  // the single threaded one did, which it couldn't if the tables shared any
+  // state.
+
+int testStreams(int argc, char* argv[])
+{
+    unsigned maxThreads = max(2u, thread::hardware_concurrency());
+    int first = 0;
+    if (argc >= 2  &&  strcmp(argv[0], "-threads") == 0)
+    {
+        maxThreads = max(1, atoi(argv[1]));
+        first = 2;
+    }
+    if (first >= argc)
+    {
+        cout << "Usage: nametable -streams [-threads n] commandfile..." << endl;
+        return 2;
+    }
+
+      // Each file is checked and counted a chunk at a time up front, so a
+      // corrupt trace is caught before anything is timed
+    Timer timer;
+    vector<unique_ptr<CommandFile>> files;
+    size_t totalCommands = 0;
+    vector<CommandRecord> recs;
+    for (int k = first; k < argc; k++)
+    {
+        files.push_back(unique_ptr<CommandFile>(new CommandFile));
+        bool ok = files.back()->open(argv[k]);
+        for (size_t n; ok  &&  (n = files.back()->next(recs, 65536)) > 0; )
+            totalCommands += n;
+        if ( ! ok  ||  files.back()->failed())
+        {
+            cout << "Cannot load " << argv[k] << endl;
+            return 1;
+        }
+    }
+    recs = vector<CommandRecord>();
+    cout << "Checked " << files.size() << " streams of " << totalCommands << " commands in all in "
+         << timer.elapsed() << " msec; " << thread::hardware_concurrency()
+         << " hardware threads." << endl;
+
+    vector<unsigned long long> expected;
+    double single = 0;
+    for (unsigned n = 1; ; n = min(2 * n, maxThreads))
+    {
+        vector<unsigned long long> checksums(files.size());
+          // Every thread would otherwise bump the one allocation counter
+        countAllocations = false;
+        timer.start();
+        runWorkStealing(n, files.size(), [&](size_t s) {
+            NameTable nt;
+            checksums[s] = replayCommands(*files[s], nt, nullptr, nullptr);
+        });
+        double elapsed = timer.elapsed();
+        countAllocations = true;
+        if (n == 1)
+        {
+            expected = checksums;
+            single = elapsed;
+        }
+        else if (checksums != expected)
+        {
+            cout << "*** FAILED *** " << n << " threads gave different results from 1" << endl;
+            return 1;
+        }
+        ostringstream line;
+        line << fixed << setprecision(1) << setw(3) << n << " threads: "
+             << (elapsed > 0 ? totalCommands / elapsed / 1000 : 0) << " million commands/sec, "
+             << setprecision(2) << single / elapsed << "x speedup, "
+             << single / elapsed / n << " per thread";
+        cout << "  " << line.str() << endl;
+        if (n >= maxThreads)
+            break;
+    }
+    return 0;
+}
+
+  // A bounded queue for exactly one producer thread and one consumer
+  // thread, without locks.  Each side only ever writes its own index and
+  // keeps a copy of the other side's, which it only refreshes when the
+  // ring looks full (or empty), so the two threads seldom touch the same
+  // cache line.  The capacity must be a power of 2.
+
+template<typename T>
+class SpscRing
+{
+  public:
+    explicit SpscRing(size_t capacity)
+     : m_slots(capacity), m_mask(capacity - 1), m_head(0), m_cachedTail(0),
+       m_tail(0), m_cachedHead(0)
+    {}
+    bool tryPush(const T& item)
+    {
+        size_t tail = m_tail.load(memory_order_relaxed);
+        if (tail - m_cachedHead == m_slots.size())
+        {
+            m_cachedHead = m_head.load(memory_order_acquire);
+            if (tail - m_cachedHead == m_slots.size())
+                return false;
+        }
+        m_slots[tail & m_mask] = item;
+        m_tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+    bool tryPop(T& item)
+    {
+        size_t head = m_head.load(memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(memory_order_acquire);
+            if (head == m_cachedTail)
+                return false;
+        }
+        item = m_slots[head & m_mask];
+        m_head.store(head + 1, memory_order_release);
+        return true;
+    }
+  private:
+    vector<T> m_slots;
+    size_t m_mask;
+    alignas(64) atomic<size_t> m_head;  // next slot to pop; only the consumer writes it
+    size_t m_cachedTail;                // the consumer's copy of m_tail
+    alignas(64) atomic<size_t> m_tail;  // next slot to push; only the producer writes it
+    size_t m_cachedHead;                // the producer's copy of m_head
+};
+
+  // A command as the pipeline hands it over.  Each distinct name is
+  // numbered in order of first use, so the consumer interns it the first
+  // time that number comes along and uses the symbol from then on.  id
+  // points at the name's key in the producer's dictionary, which never
+  // moves.
+
+struct PipelineRecord
+{
+    unsigned char op;  // a CommandBatch::Op, or TRACE_END after the last command
+    int lineNum;       // DECLARE only
+    int idIndex;       // DECLARE and FIND
+    const string* id;
+};
+
+  // Numbers each distinct name in the order it is first seen.  The
+  // spellings live in a deque, which never moves them, so the map can be
+  // keyed by string_views into it and looking up a name seen before
+  // copies nothing.
+
+struct NameNumbering
+{
+    unordered_map<string_view, int> numbers;
+    deque<string> spellings;
+};
+
+  // Parses a line exactly like Command::create (with the same splitter
+  // CommandFile uses, so no stream is built per line), numbering names in
+  // names.  Returns false for a line with no command on it.
+
+bool parseRecord(string_view line, NameNumbering& names, PipelineRecord& rec)
+{
+    CommandRecord cr;
+    if ( ! parseCommandLine(line, cr))
+        return false;
+    rec.op = cr.op;
+    rec.lineNum = cr.lineNum;
+    rec.idIndex = -1;
+    rec.id = nullptr;
+    if (cr.op == CommandBatch::DECLARE  ||  cr.op == CommandBatch::FIND)
+    {
+        auto it = names.numbers.find(cr.id);
+        if (it == names.numbers.end())
+        {
+            names.spellings.emplace_back(cr.id);
+            it = names.numbers.emplace(names.spellings.back(), static_cast<int>(names.spellings.size() - 1)).first;
+        }
+        rec.idIndex = it->second;
+        rec.id = &names.spellings[it->second];
+    }
+    return true;
+}
+
+  // Runs one record, folding its result into checksum
+
+void executeRecord(const PipelineRecord& rec, NameTable& nt, vector<SymbolId>& symbols,
+                   unsigned long long& checksum)
+{
+    int result;
+    switch (rec.op)
+    {
+      case CommandBatch::ENTER_SCOPE:
+        nt.enterScope();
+        result = 1;
+        break;
+      case CommandBatch::EXIT_SCOPE:
+        result = nt.exitScope();
+        break;
+      default:
+        if (rec.idIndex == static_cast<int>(symbols.size()))
+            symbols.push_back(nt.intern(*rec.id));
+        if (rec.op == CommandBatch::DECLARE)
+            result = nt.declare(symbols[rec.idIndex], rec.lineNum);
+        else
+            result = nt.find(symbols[rec.idIndex]);
+        break;
+    }
+    checksum = checksum * 1000003 + static_cast<unsigned>(result);
+}
+
+  // Reads and runs a text command file three ways: one thread parsing
+  // each line with Command::create and running it, as the performance test
+  // does; one thread parsing into PipelineRecords and running those; and a
+  // producer thread parsing into the ring while this thread runs what
+  // comes out.  The last two must get the same results.
+
+int testPipeline(const char* path)
+{
+    const size_t RING_SIZE = 4096;
+
+    {
+        ifstream check(path, ios::binary);
+        char magic[TRACE_MAGIC_SIZE];
+        if ( ! check)
+        {
+            cout << "Cannot load " << path << endl;
+            return 1;
+        }
+        if (check.read(magic, TRACE_MAGIC_SIZE)  &&  memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0)
+        {
+            cout << path << " is a binary trace, which needs no parsing to pipeline" << endl;
+            return 1;
+        }
+    }
+
+    size_t count = 0;
+    Timer timer;
+    {
+        ifstream f(path);
+        NameTable nt;
+        string line;
+        int lineno = 0;
+        while (getline(f, line))
+        {
+            Command* cmd = Command::create(line, ++lineno);
+            if (cmd != nullptr)
+            {
+                cmd->execute(nt);
+                delete cmd;
+                count++;
+            }
+        }
+    }
+    double commandTime = timer.elapsed();
+
+    unsigned long long serialChecksum = 0;
+    timer.start();
+    {
+        ifstream f(path);
+        NameTable nt;
+        NameNumbering names;
+        vector<SymbolId> symbols;
+        string line;
+        PipelineRecord rec;
+        while (getline(f, line))
+        {
+            if (parseRecord(line, names, rec))
+                executeRecord(rec, nt, symbols, serialChecksum);
+        }
+    }
+    double serialTime = timer.elapsed();
+
+    unsigned long long pipelineChecksum = 0;
+    unsigned long long producerStalls = 0;
+    unsigned long long consumerStalls = 0;
+    timer.start();
+    {
+        SpscRing<PipelineRecord> ring(RING_SIZE);
+        NameNumbering names;
+        thread producer([&]() {
+            ifstream f(path);
+            string line;
+            PipelineRecord rec;
+            while (getline(f, line))
+            {
+                if ( ! parseRecord(line, names, rec))
+                    continue;
+                while ( ! ring.tryPush(rec))
+                {
+                    producerStalls++;
+                    this_thread::yield();
+                }
+            }
+            rec.op = TRACE_END;
+            while ( ! ring.tryPush(rec))
+                this_thread::yield();
+        });
+
+        NameTable nt;
+        vector<SymbolId> symbols;
+        PipelineRecord rec;
+        for (;;)
+        {
+            if ( ! ring.tryPop(rec))
+            {
+                consumerStalls++;
+                this_thread::yield();
+                continue;
+            }
+            if (rec.op == TRACE_END)
+                break;
+            executeRecord(rec, nt, symbols, pipelineChecksum);
+        }
+        producer.join();
+    }
+    double pipelineTime = timer.elapsed();
+
+    if (pipelineChecksum != serialChecksum)
+    {
+        cout << "*** FAILED *** the pipeline got different results" << endl;
+        return 1;
+    }
+    cout << count << " commands from " << path << ", " << thread::hardware_concurrency()
+         << " hardware threads." << endl
+         << "    Command::create, one thread: " << commandTime << " msec." << endl
+         << "            Records, one thread: " << serialTime << " msec." << endl
+         << "  Records, pipelined, 2 threads: " << pipelineTime << " msec ("
+         << (pipelineTime > 0 ? serialTime / pipelineTime : 0) << "x), stalled "
+         << producerStalls << " times full and " << consumerStalls << " times empty." << endl;
+    return 0;
+}
+
+void SlowNameTable::enterScope()
+{
+      // Extend the id vector with an empty string that
+      // serves as a scope entry marker.
+
+    m_ids.push_back("");
+    m_lines.push_back(0);
+}
+
+bool SlowNameTable::exitScope()
+{
+      // Remove ids back to the last scope entry.
+
+    while (!m_ids.empty()  &&  m_ids.back() != "")
+    {
+        m_ids.pop_back();
+        m_lines.pop_back();
+    }
+    if (m_ids.empty())
+        return false;
+
+      // Remove the scope entry marker itself.
+
+    m_ids.pop_back();
+    m_lines.pop_back();
+    return true;
+}
+
+bool SlowNameTable::declare(const string& id, int lineNum)
+{
+    if (id.empty())
+        return false;
+
+      // Check for another declaration in the same scope.
+      // Return if found, break out if encounter the scope
+      // entry marker.
+
+    size_t k = m_ids.size();
+    while (k > 0)
+    {
+        k--;
+        if (m_ids[k].empty())
+            break;
+        if (m_ids[k] == id)
+            return false;
+    }
+
+      // Save the declaration
+
+    m_ids.push_back(id);
+    m_lines.push_back(lineNum);
+    return true;
+}
+
+vector<size_t> SlowNameTable::declarationsPerScope() const
+{
+    vector<size_t> counts(1, 0);
+    for (size_t k = 0; k < m_ids.size(); k++)
+    {
+        if (m_ids[k].empty())
+            counts.push_back(0);
+        else
+            counts.back()++;
+    }
+    return counts;
+}
+
+int SlowNameTable::find(const string& id) const
+{
+    if (id.empty())
+        return -1;
+
+      // Search back for the most recent declaration still
+      // available.
+
+    size_t k = m_ids.size();
+    while (k > 0)
+    {
+        k--;
+        if (m_ids[k] == id)
+            return m_lines[k];
+    }
+    return -1;
+}
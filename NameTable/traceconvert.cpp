@@ -0,0 +1,88 @@
+// Command file converter
+//
+// Usage: traceconvert input output
+//
+// Converts a text command file (the format of commands.txt) into the
+// binary trace format described in CommandFile.h, or a binary trace back
+// into text.  The direction is decided by the format of the input.
+
+#include "CommandFile.h"
+#include <iostream>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+bool writeBinary(const CommandFile& in, ostream& out)
+{
+      // Give every distinct id a string table index, in order of first use
+
+    unordered_map<string_view, int> indexes;
+    vector<string_view> strings;
+    vector<CommandRecord> recs = in.commands();
+    for (size_t k = 0; k < recs.size(); k++)
+    {
+        if (recs[k].op != CommandBatch::DECLARE  &&  recs[k].op != CommandBatch::FIND)
+            continue;
+        auto p = indexes.insert(make_pair(recs[k].id, static_cast<int>(strings.size())));
+        if (p.second)
+            strings.push_back(recs[k].id);
+        recs[k].idIndex = p.first->second;
+    }
+
+    TraceWriter writer(out, strings);
+    for (size_t k = 0; k < recs.size(); k++)
+        writer.write(recs[k]);
+    return writer.finish();
+}
+
+bool writeText(const CommandFile& in, ostream& out)
+{
+    const vector<CommandRecord>& recs = in.commands();
+    for (size_t k = 0; k < recs.size(); k++)
+    {
+        switch (recs[k].op)
+        {
+          case CommandBatch::ENTER_SCOPE:  out << "{\n";                                   break;
+          case CommandBatch::EXIT_SCOPE:   out << "}\n";                                   break;
+          case CommandBatch::DECLARE:      out << recs[k].id << ' ' << recs[k].lineNum << '\n'; break;
+          case CommandBatch::FIND:         out << recs[k].id << '\n';                      break;
+        }
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " input output" << endl;
+        return 2;
+    }
+
+    CommandFile in;
+    if (!in.load(argv[1]))
+    {
+        cerr << "Cannot load " << argv[1] << endl;
+        return 1;
+    }
+    ofstream out(argv[2], ios::binary);
+    if ( ! out)
+    {
+        cerr << "Cannot create " << argv[2] << endl;
+        return 1;
+    }
+
+    bool ok = in.isBinary() ? writeText(in, out) : writeBinary(in, out);
+    if (!ok)
+    {
+        cerr << "Error writing " << argv[2] << endl;
+        return 1;
+    }
+    cout << "Converted " << in.commands().size() << " commands from "
+         << (in.isBinary() ? "binary" : "text") << " to "
+         << (in.isBinary() ? "text" : "binary") << "." << endl;
+    return 0;
+}